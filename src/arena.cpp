@@ -0,0 +1,36 @@
+#include "arena.h"
+
+#include <algorithm>
+#include <new>
+
+Arena::~Arena()
+{
+	for(const auto& block : blocks) ::operator delete(block.first);
+}
+
+void Arena::grow(size_t bytes)
+{
+	size_t size = blocks.empty() ? FIRST_BLOCK : 2 * blocks.back().second;
+	size = std::max(size, bytes);
+	blocks.emplace_back(static_cast<char*>(::operator new(size)), size);
+}
+
+void Arena::reset()
+{
+	//Blocks are merged into one, so the next run of the same size needs a single block and no growth
+	if(blocks.size() > 1)
+	{
+		size_t size = capacity();
+		for(const auto& block : blocks) ::operator delete(block.first);
+		blocks.clear();
+		blocks.emplace_back(static_cast<char*>(::operator new(size)), size);
+	}
+	used = 0;
+}
+
+size_t Arena::capacity() const
+{
+	size_t size = 0;
+	for(const auto& block : blocks) size += block.second;
+	return size;
+}
@@ -0,0 +1,126 @@
+#pragma once
+
+#ifndef _ARENA_H
+#define _ARENA_H
+
+#include <cstddef>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+//Class Arena: Monotonic allocator for the intermediates of one stage run.
+//Allocation bumps an offset through the current block and freeing is a no-op, everything handed out
+//goes at once when the arena is reset. A reset keeps a single block as large as all blocks before it,
+//so a stage running again on an image of similar size doesn't touch the global heap at all.
+//Not thread safe, every arena belongs to one stage object.
+
+class Arena
+{
+	//Blocks taken from the heap, the last one is being filled
+	std::vector<std::pair<char*, size_t> > blocks;
+
+	//Bytes used in the last block
+	size_t used;
+
+	//Size of the first block, later ones double
+	static const size_t FIRST_BLOCK = 64 << 10;
+
+	//Starts a block with room for bytes
+	void grow(size_t bytes);
+	public:
+		Arena() : used(0) {}
+		~Arena();
+
+		Arena(const Arena&) = delete;
+		Arena& operator=(const Arena&) = delete;
+
+		//Returns bytes of memory aligned to alignment, which is at most alignof(std::max_align_t)
+		void* allocate(size_t bytes, size_t alignment)
+		{
+			if(!blocks.empty())
+			{
+				size_t offset = (used + alignment - 1) & ~(alignment - 1);
+				if(offset + bytes <= blocks.back().second)
+				{
+					used = offset + bytes;
+					return blocks.back().first + offset;
+				}
+			}
+			grow(bytes);
+			used = bytes;
+			return blocks.back().first;
+		}
+
+		//Releases everything allocated so far. Memory from the arena must not be used afterwards.
+		void reset();
+
+		//Bytes reserved from the heap
+		size_t capacity() const;
+};
+
+//Class ArenaAllocator: Standard allocator drawing from an Arena, or from the global heap when
+//constructed without one. The arena moves along with the container contents on assignment and swap.
+
+template<typename T>
+class ArenaAllocator
+{
+	template<typename U> friend class ArenaAllocator;
+	Arena* arena;
+	public:
+		typedef T value_type;
+		typedef std::true_type propagate_on_container_copy_assignment;
+		typedef std::true_type propagate_on_container_move_assignment;
+		typedef std::true_type propagate_on_container_swap;
+
+		ArenaAllocator(Arena* arena = nullptr) noexcept : arena(arena) {}
+		template<typename U> ArenaAllocator(const ArenaAllocator<U>& other) noexcept : arena(other.arena) {}
+
+		T* allocate(size_t n)
+		{
+			if(arena) return static_cast<T*>(arena->allocate(n * sizeof(T), alignof(T)));
+			return static_cast<T*>(::operator new(n * sizeof(T)));
+		}
+		void deallocate(T* p, size_t) noexcept
+		{
+			if(!arena) ::operator delete(p);
+		}
+
+		template<typename U> bool operator==(const ArenaAllocator<U>& other) const {return arena == other.arena;}
+		template<typename U> bool operator!=(const ArenaAllocator<U>& other) const {return arena != other.arena;}
+};
+
+//Vector whose buffer lives in an arena
+template<typename T> using ArenaVector = std::vector<T, ArenaAllocator<T> >;
+
+//Empties container and resets arena, then binds container to arena for the next fill. Containers may
+//keep memory while empty, so container is first moved over to the heap allocator.
+template<typename Container>
+void resetArena(Arena& arena, Container& container)
+{
+	container = Container();
+	arena.reset();
+	container = Container(typename Container::allocator_type(&arena));
+}
+
+//Resizes v to n elements. Elements removed from the end are parked in spare and added ones are taken
+//from there, so buffers they own outlive a smaller result and get reused by the next larger one.
+template<typename T>
+void resizeReusing(std::vector<T>& v, size_t n, std::vector<T>& spare)
+{
+	while(v.size() > n)
+	{
+		spare.push_back(std::move(v.back()));
+		v.pop_back();
+	}
+	while(v.size() < n)
+	{
+		if(spare.empty()) v.emplace_back();
+		else
+		{
+			v.push_back(std::move(spare.back()));
+			spare.pop_back();
+		}
+	}
+}
+
+#endif
@@ -0,0 +1,261 @@
+#include "common.h"
+#include "image.h"
+#include "graph.h"
+#include "voronoi.h"
+#include "spline.h"
+#include "BMP.h"
+#include "svgshapes.h"
+#include "files.h"
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <limits>
+#include <map>
+#include <memory>
+
+#ifndef BENCH_INPUTS
+#define BENCH_INPUTS "test"
+#endif
+
+using namespace std;
+
+//One image the stages are measured on
+struct BenchInput
+{
+	//File name, with @<k>x for upscaled copies
+	std::string name;
+	std::unique_ptr<Image> image;
+};
+
+//Fastest time of one benchmark on one input
+struct BenchResult
+{
+	std::string benchmark;
+	std::string input;
+	long long pixels;
+	double seconds;
+
+	double nsPerPixel() const {return seconds * 1e9 / pixels;}
+};
+
+//Fastest of reps runs of body in seconds. setup runs before every run and isn't timed, it brings the
+//stage objects back to the state body expects.
+template<typename Setup, typename Body>
+double best(int reps, Setup setup, Body body)
+{
+	double fastest = std::numeric_limits<double>::infinity();
+	for(int r = 0; r < reps; r++)
+	{
+		setup();
+		auto start = std::chrono::steady_clock::now();
+		body();
+		std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+		fastest = min(fastest, elapsed.count());
+	}
+	return fastest;
+}
+
+//Nearest neighbour upscale of bmp by k, so that the stages see the same shapes on k * k as many pixels
+static std::unique_ptr<Image> upscale(BMP& bmp, int k)
+{
+	if(k == 1) return std::unique_ptr<Image>(new Image(bmp));
+	int width = bmp.bmp_info_header.width, height = bmp.bmp_info_header.height;
+	BMP large(width * k, height * k, false);
+	for(int x = 0; x < width * k; x++)
+		for(int y = 0; y < height * k; y++)
+		{
+			uint8_t b, g, r, a;
+			bmp.get_pixel(x / k, y / k, b, g, r, a);
+			large.set_pixel(x, y, b, g, r, a);
+		}
+	return std::unique_ptr<Image>(new Image(large));
+}
+
+//Runs every benchmark whose name contains filter on input, single threaded: no stage gets a pool. Every stage is measured
+//on the result of the stages before it, as the pipeline runs them.
+static void benchmark(BenchInput& input, int reps, const std::string& filter, vector<BenchResult>& results)
+{
+	Image& image = *input.image;
+	long long pixels = (long long)image.getWidth() * image.getHeight();
+	auto measure = [&](const char* name, std::function<void()> setup, std::function<void()> body)
+	{
+		if(!filter.empty() && std::string(name).find(filter) == std::string::npos) return;
+		results.push_back(BenchResult{name, input.name, pixels, best(reps, setup, body)});
+	};
+	auto nothing = []() {};
+
+	Graph graph;
+	measure("graph", nothing, [&]() { graph.reset(image); });
+	measure("remove_cross", [&]() { graph.reset(image); }, [&]() { graph.remove_cross(); });
+	measure("planarize", [&]() { graph.reset(image); }, [&]() { graph.planarize(false); });
+	const std::pair<const char*, Graph::Heuristic> heuristics[] = {
+		{"islands", Graph::ISLANDS}, {"curves", Graph::CURVES}, {"sparse", Graph::SPARSE}};
+	for(const auto& heuristic : heuristics)
+		measure(heuristic.first, [&]() { graph.reset(image); graph.remove_cross(); },
+			[&]() { graph.weighCrossings(heuristic.second); });
+	graph.reset(image);
+	graph.planarize(false);
+
+	Voronoi diagram;
+	diagram.reset(image);
+	measure("createRegions", [&]() { diagram.clear(); }, [&]() { diagram.createRegions(graph); });
+	measure("collapseValence2", [&]() { diagram.clear(); diagram.createRegions(graph); }, [&]() { diagram.collapseValence2(); });
+	diagram.createDiagram(graph);
+
+	Spline spline(&diagram);
+	std::vector<std::pair<std::vector<Point>,Color> > curves;
+	measure("extractActiveEdges", nothing, [&]() { spline.extractActiveEdges(); });
+	spline.extractActiveEdges();
+	measure("calculateGraph", nothing, [&]() { spline.calculateGraph(); });
+	//Tracing uses up the edges of the adjacency list
+	measure("traverseGraph", [&]() { spline.calculateGraph(); }, [&]() { spline.printGraph(curves); });
+	spline.calculateGraph();
+	spline.printGraph(curves);
+
+	//Cells and curves formatted with the shapes of depixelize-svg at its default settings, into memory
+	svg::Layout layout(svg::Dimensions(10.0 * image.getWidth(), 10.0 * image.getHeight()), svg::Layout::TopLeft);
+	layout.precision = 3;
+	Fragment out{std::string(), &layout, 10};
+	measure("svg", [&]() { out.text.clear(); }, [&]()
+	{
+		for(int x = 0; x < image.getWidth(); x++)
+			for(int y = 0; y < image.getHeight(); y++)
+				drawPolygon(out, diagram.getHull(x, y), image(x, y)->color());
+		for(const auto& curve : curves) drawCurve(out, curve.first, curve.second);
+	});
+}
+
+//Baseline files are tab separated lines of benchmark, input and ns per pixel, # starts a comment line
+typedef std::map<std::pair<std::string, std::string>, double> Baseline;
+
+static bool readBaseline(const std::string& path, Baseline& baseline)
+{
+	std::ifstream file(path);
+	if(!file) return false;
+	std::string line;
+	while(std::getline(file, line))
+	{
+		if(line.empty() || line[0] == '#') continue;
+		std::istringstream fields(line);
+		std::string benchmark, input;
+		double nsPerPixel;
+		if(std::getline(fields, benchmark, '\t') && std::getline(fields, input, '\t') && fields >> nsPerPixel)
+			baseline[make_pair(benchmark, input)] = nsPerPixel;
+	}
+	return true;
+}
+
+static bool writeBaseline(const std::string& path, const vector<BenchResult>& results)
+{
+	std::ofstream file(path);
+	file << "#benchmark\tinput\tnsPerPixel\n";
+	for(const auto& result : results)
+		file << result.benchmark << '\t' << result.input << '\t' << std::setprecision(6) << result.nsPerPixel() << '\n';
+	file.flush();
+	return file.good();
+}
+
+int main(int argc, char* argv[])
+{
+	std::string inputs = BENCH_INPUTS;
+	std::string scaleList = "1,4";
+	std::string filter, savePath, comparePath;
+	int reps = 5;
+	double threshold = 10;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--inputs" && i + 1 < argc) inputs = argv[++i];
+		else if (arg == "--scales" && i + 1 < argc) scaleList = argv[++i];
+		else if (arg == "--reps" && i + 1 < argc) reps = max(1, atoi(argv[++i]));
+		else if (arg == "--filter" && i + 1 < argc) filter = argv[++i];
+		else if (arg == "--save" && i + 1 < argc) savePath = argv[++i];
+		else if (arg == "--compare" && i + 1 < argc) comparePath = argv[++i];
+		else if (arg == "--threshold" && i + 1 < argc) threshold = atof(argv[++i]);
+		else {
+			std::cout << "Usage: " << argv[0] << " [--inputs spec] [--scales k,...] [--reps n] [--filter name] [--save path] [--compare path] [--threshold %]" << endl;
+			std::cout << "  --inputs spec   directory, pattern or manifest of the .bmp inputs (default " << inputs << ")" << endl;
+			std::cout << "  --scales k,...  nearest neighbour upscales every input is measured at (default " << scaleList << ")" << endl;
+			std::cout << "  --reps n        runs per benchmark, the fastest counts (default " << reps << ")" << endl;
+			std::cout << "  --filter name   only the benchmarks whose name contains name" << endl;
+			std::cout << "  --save path     write the results as a baseline" << endl;
+			std::cout << "  --compare path  compare with a saved baseline, exit code 1 on a regression" << endl;
+			std::cout << "  --threshold %   slowdown per pixel that counts as a regression (default " << threshold << ")" << endl;
+			return 1;
+		}
+	}
+
+	vector<int> scales;
+	std::istringstream scaleFields(scaleList);
+	std::string scale;
+	while (std::getline(scaleFields, scale, ','))
+		if (atoi(scale.c_str()) > 0) scales.push_back(atoi(scale.c_str()));
+
+	vector<std::string> paths;
+	std::string error;
+	if (!listInputs(inputs, ".bmp", paths, error)) {
+		std::cout << error << endl;
+		return 1;
+	}
+	if (paths.empty() || scales.empty()) {
+		std::cout << "Nothing to measure" << endl;
+		return 1;
+	}
+
+	Baseline baseline;
+	if (!comparePath.empty() && !readBaseline(comparePath, baseline)) {
+		std::cout << "Couldn't read " << comparePath << endl;
+		return 1;
+	}
+
+	vector<BenchResult> results;
+	for (const auto& path : paths) {
+		size_t slash = path.find_last_of("/\\");
+		std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+		try {
+			BMP bmp(path.c_str());
+			for (int k : scales) {
+				BenchInput input{k == 1 ? name : name + "@" + to_string(k) + "x", upscale(bmp, k)};
+				benchmark(input, reps, filter, results);
+			}
+		}
+		catch (const std::exception& e) {
+			std::cout << path << ": " << e.what() << endl;
+			return 1;
+		}
+	}
+
+	//Table of the results, with the change against the baseline if there is one
+	int regressions = 0;
+	std::cout << left << setw(20) << "benchmark" << setw(24) << "input" << right << setw(10) << "pixels"
+		<< setw(12) << "best ms" << setw(12) << "ns/pixel";
+	if (!comparePath.empty()) std::cout << setw(10) << "change";
+	std::cout << endl << fixed;
+	for (const auto& result : results) {
+		std::cout << left << setw(20) << result.benchmark << setw(24) << result.input << right << setw(10) << result.pixels
+			<< setw(12) << setprecision(3) << result.seconds * 1e3 << setw(12) << setprecision(2) << result.nsPerPixel();
+		auto known = baseline.find(make_pair(result.benchmark, result.input));
+		if (known != baseline.end() && known->second > 0) {
+			double change = (result.nsPerPixel() / known->second - 1) * 100;
+			std::cout << setw(9) << setprecision(1) << showpos << change << noshowpos << '%';
+			if (change > threshold) {
+				std::cout << "  regression";
+				regressions++;
+			}
+		}
+		std::cout << endl;
+	}
+
+	if (!savePath.empty() && !writeBaseline(savePath, results)) {
+		std::cout << "Couldn't write " << savePath << endl;
+		return 1;
+	}
+	if (!comparePath.empty())
+		std::cout << regressions << " of " << results.size() << " benchmarks more than " << threshold << "% slower than " << comparePath << endl;
+	return regressions ? 1 : 0;
+}
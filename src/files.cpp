@@ -0,0 +1,143 @@
+#include "files.h"
+
+#include <algorithm>
+#include <cctype>
+#include <fstream>
+#include <sys/stat.h>
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#else
+#include <dirent.h>
+#endif
+
+//Regular files of dir, without the directory part
+static bool listDirectory(const std::string& dir, std::vector<std::string>& names)
+{
+#ifdef _WIN32
+	WIN32_FIND_DATAA entry;
+	HANDLE find = FindFirstFileA((dir + "\\*").c_str(), &entry);
+	if(find == INVALID_HANDLE_VALUE) return false;
+	do
+	{
+		if(!(entry.dwFileAttributes & FILE_ATTRIBUTE_DIRECTORY)) names.push_back(entry.cFileName);
+	}
+	while(FindNextFileA(find, &entry));
+	FindClose(find);
+#else
+	DIR* handle = opendir(dir.c_str());
+	if(!handle) return false;
+	while(dirent* entry = readdir(handle))
+	{
+		struct stat info;
+		std::string path = dir + "/" + entry->d_name;
+		if(stat(path.c_str(), &info) == 0 && S_ISREG(info.st_mode)) names.push_back(entry->d_name);
+	}
+	closedir(handle);
+#endif
+	return true;
+}
+
+static bool isDirectory(const std::string& path)
+{
+	struct stat info;
+	return stat(path.c_str(), &info) == 0 && (info.st_mode & S_IFMT) == S_IFDIR;
+}
+
+//Matches name against a pattern of literal characters, * for any run and ? for any single character
+static bool wildcardMatch(const char* pattern, const char* name)
+{
+	//Position after the last * and the name position it is currently assumed to have consumed up to
+	const char* star = nullptr;
+	const char* resume = nullptr;
+	while(*name)
+	{
+		if(*pattern == '*')
+		{
+			star = ++pattern;
+			resume = name;
+		}
+		else if(*pattern == '?' || *pattern == *name)
+		{
+			pattern++;
+			name++;
+		}
+		else if(star)
+		{
+			pattern = star;
+			name = ++resume;
+		}
+		else return false;
+	}
+	while(*pattern == '*') pattern++;
+	return !*pattern;
+}
+
+static bool endsWith(const std::string& name, const std::string& suffix)
+{
+	if(name.size() < suffix.size()) return false;
+	return std::equal(suffix.begin(), suffix.end(), name.end() - suffix.size(),
+		[](char a, char b) { return std::tolower((unsigned char)a) == std::tolower((unsigned char)b); });
+}
+
+bool listInputs(const std::string& spec, const std::string& extension, std::vector<std::string>& paths, std::string& error)
+{
+	size_t slash = spec.find_last_of("/\\");
+	std::string dir = slash == std::string::npos ? "." : spec.substr(0, slash);
+	std::string last = slash == std::string::npos ? spec : spec.substr(slash + 1);
+	std::vector<std::string> names;
+	size_t first = paths.size();
+
+	if(isDirectory(spec))
+	{
+		if(!listDirectory(spec, names))
+		{
+			error = "can't list directory " + spec;
+			return false;
+		}
+		std::string prefix = spec.back() == '/' || spec.back() == '\\' ? spec : spec + "/";
+		for(const auto& name : names)
+			if(endsWith(name, extension)) paths.push_back(prefix + name);
+	}
+	else if(last.find_first_of("*?") != std::string::npos)
+	{
+		if(!listDirectory(dir, names))
+		{
+			error = "can't list directory " + dir;
+			return false;
+		}
+		for(const auto& name : names)
+			if(wildcardMatch(last.c_str(), name.c_str()))
+				paths.push_back(slash == std::string::npos ? name : dir + "/" + name);
+	}
+	else
+	{
+		std::ifstream manifest(spec);
+		if(!manifest)
+		{
+			error = "can't read " + spec;
+			return false;
+		}
+		std::string line;
+		while(std::getline(manifest, line))
+		{
+			//Trailing carriage returns and blanks of manifests written elsewhere
+			while(!line.empty() && std::isspace((unsigned char)line.back())) line.pop_back();
+			size_t start = line.find_first_not_of(" \t");
+			if(start == std::string::npos || line[start] == '#') continue;
+			paths.push_back(line.substr(start));
+		}
+		//The manifest keeps its own order
+		return true;
+	}
+	std::sort(paths.begin() + first, paths.end());
+	return true;
+}
+
+long long fileSize(const std::string& path)
+{
+	struct stat info;
+	if(stat(path.c_str(), &info) != 0) return -1;
+	return info.st_size;
+}
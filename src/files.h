@@ -0,0 +1,20 @@
+#pragma once
+
+#ifndef _FILES_H
+#define _FILES_H
+
+#include <string>
+#include <vector>
+
+//Helpers for finding input files, on top of the platform's directory listing
+
+//Appends the paths spec stands for. spec is either a directory, whose files ending in extension are
+//listed, a pattern with * and ? wildcards in its last path component, or a manifest file with one
+//path per line (empty lines and lines starting with # are skipped). Listed files come sorted, the
+//manifest keeps its order. Returns false with error set if spec can't be read.
+bool listInputs(const std::string& spec, const std::string& extension, std::vector<std::string>& paths, std::string& error);
+
+//Size of the file in bytes, -1 if it doesn't exist
+long long fileSize(const std::string& path);
+
+#endif
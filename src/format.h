@@ -0,0 +1,113 @@
+#pragma once
+
+#ifndef _FORMAT_H
+#define _FORMAT_H
+
+#include <cmath>
+#include <cstdio>
+
+//Locale free number formatting for the vector and JSON writers.
+//Every function writes into a caller buffer of at least FORMAT_BUFFER_SIZE bytes, without a
+//terminating zero, and returns the end of the written characters. Output always uses '.' as the
+//decimal point and never carries exponent notation, except for values beyond the ranges below.
+
+const int FORMAT_BUFFER_SIZE = 48;
+
+//Precision value asking for the shortest round-trip form instead of a fixed number of decimals
+const int SHORTEST_PRECISION = -1;
+
+//Writes the decimal digits of v
+inline char* formatUnsigned(char* out, unsigned long long v)
+{
+	char digits[24];
+	int n = 0;
+	do { digits[n++] = char('0' + v % 10); v /= 10; } while(v);
+	while(n) *out++ = digits[--n];
+	return out;
+}
+
+inline char* formatInt(char* out, long long v)
+{
+	if(v < 0)
+	{
+		*out++ = '-';
+		return formatUnsigned(out, 0ULL - (unsigned long long)v);
+	}
+	return formatUnsigned(out, (unsigned long long)v);
+}
+
+//NaN, infinities and values too large or small for the fast paths. These are rare, so snprintf is fine,
+//only the decimal point a foreign locale may have put in has to be undone.
+inline char* formatFallback(char* out, double v)
+{
+	char tmp[FORMAT_BUFFER_SIZE];
+	int n = std::snprintf(tmp, sizeof(tmp), "%.9g", v);
+	for(int i = 0; i < n; i++)
+	{
+		char c = tmp[i];
+		bool plain = (c >= '0' && c <= '9') || c == '-' || c == '+' || c == 'e' || (c >= 'a' && c <= 'z');
+		*out++ = plain ? c : '.';
+	}
+	return out;
+}
+
+//Fixed point with at most decimals (0 to 17) digits after the point, trailing zeros trimmed: 12.5, 3, 0.3333
+inline char* formatFixed(char* out, double v, int decimals)
+{
+	static const unsigned long long pow10[] = {1ULL, 10ULL, 100ULL, 1000ULL, 10000ULL, 100000ULL, 1000000ULL,
+		10000000ULL, 100000000ULL, 1000000000ULL, 10000000000ULL, 100000000000ULL, 1000000000000ULL,
+		10000000000000ULL, 100000000000000ULL, 1000000000000000ULL, 10000000000000000ULL, 100000000000000000ULL};
+	if(decimals < 0) decimals = 0;
+	if(decimals > 17) decimals = 17;
+	bool negative = v < 0;
+	double magnitude = (negative ? -v : v) * pow10[decimals];
+	if(!(magnitude < 9e18)) return formatFallback(out, v);
+
+	unsigned long long scaled = (unsigned long long)(magnitude + 0.5);
+	if(negative && scaled) *out++ = '-';
+	out = formatUnsigned(out, scaled / pow10[decimals]);
+	unsigned long long frac = scaled % pow10[decimals];
+	if(frac)
+	{
+		*out++ = '.';
+		for(int d = decimals - 1; d >= 0 && frac; d--)
+		{
+			*out++ = char('0' + frac / pow10[d]);
+			frac %= pow10[d];
+		}
+	}
+	return out;
+}
+
+//Fewest decimals that read back as exactly v. Coordinates are single precision throughout the
+//pipeline, so round-trip is judged against float: 0.1f comes out as 0.1, not 0.100000001.
+inline char* formatShortest(char* out, float v)
+{
+	if(v == 0) return formatUnsigned(out, 0);
+	double target = v;
+	double magnitude = std::fabs(target);
+	if(!(magnitude >= 1e-5 && magnitude < 1e15)) return formatFallback(out, target);
+
+	//Any decimal strictly between the midpoints to the neighbouring floats parses back to v. The slack
+	//keeps the decimal itself inside, not just its rounding to double.
+	double low = (target + std::nextafter(v, -HUGE_VALF)) * 0.5;
+	double high = (target + std::nextafter(v, HUGE_VALF)) * 0.5;
+	double slack = std::ldexp(2.0, std::ilogb(target) - 52);
+	double scale = 1;
+	for(int d = 0; d <= 17; d++, scale *= 10)
+	{
+		if(!(magnitude * scale < 9e18)) break;
+		double candidate = std::copysign(std::floor(magnitude * scale + 0.5) / scale, target);
+		if(candidate > low + slack && candidate < high - slack) return formatFixed(out, target, d);
+	}
+	return formatFallback(out, target);
+}
+
+//Shortest round-trip form for a negative precision, fixed point with precision decimals otherwise
+inline char* formatNumber(char* out, double v, int precision)
+{
+	if(precision < 0) return formatShortest(out, (float)v);
+	return formatFixed(out, v, precision);
+}
+
+#endif
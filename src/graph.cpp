@@ -1,5 +1,4 @@
 #include "graph.h"
-#include <stack>
 #include <utility>
 
 #include <iostream>
@@ -12,24 +11,35 @@ bool isValid(int x,int y, int w, int h)
 }
 
 
-Graph::Graph(Image& imageI)
+Graph::Graph(Image& imageI, const SimilarityThresholds& similarityI, const HeuristicWeights& heuristicsI)
+{
+	reset(imageI, similarityI, heuristicsI);
+}
+
+void Graph::reset(Image& imageI, const SimilarityThresholds& similarityI, const HeuristicWeights& heuristicsI)
 {
 	//Innitializing variables from Image
 	this->image = &imageI;
+	this->similarity = similarityI;
+	this->heuristics = heuristicsI;
 	int h = image->getHeight();
 	int w = image->getWidth();
 
 	//Semantic
 	// edges[i][j][k] -> denotes whether there is a an edge from (i,j) in kth direction in the graph
-	//Preallocating structures
+	//Preallocating structures, the ones of a previous image are cleared in place and the edge nodes
+	//of the previous graph go with the arena. The weight grid never shrinks, so a smaller image
+	//doesn't free buffers a larger one needs again.
+	resetArena(arena, edges);
+	crossings = 0;
+	if(weights.size() < w) weights.resize(w);
 	for(int i = 0; i < w; i++)
 	{
-		std::vector<std::vector<int>> v2(h);
+		if(weights[i].size() < h) weights[i].resize(h);
 		for(int j = 0; j < h; j ++)
 		{
-			v2[j] = std::vector<int>(8,0);
+			weights[i][j].assign(8,0);
 		}
-		weights.push_back(v2);
 	}
 
 	//Add edge in kth direction of (x,y) of (x,y)+k is valid cell and has similar color
@@ -37,7 +47,7 @@ Graph::Graph(Image& imageI)
 		Pixel* p = (*image)(i, j);
 		Pixel* adjP = image->getAdjacent(p, (Direction)k);
 		if (adjP) {
-			if(p->color() == adjP->color())
+			if(p->color().is_similar(adjP->color(), similarity))
 				edges.insert(make_pair(IntPoint(i, j), (Direction)k));
 		};
 	}
@@ -53,12 +63,13 @@ void Graph::remove_cross()
 		Pixel* bottomLeft = (*image).getAdjacent(i, j, BOTTOM);
 		Pixel* bottomRight = (*image).getAdjacent(i, j, BOTTOM_RIGHT);
 		if(
-			topLeft->color() == topRight->color() &&
-			topLeft->color() == bottomLeft->color() &&
-			topLeft->color() == bottomRight->color() &&
-			bottomLeft->color() == topRight->color())
+			topLeft->color().is_similar(topRight->color(), similarity) &&
+			topLeft->color().is_similar(bottomLeft->color(), similarity) &&
+			topLeft->color().is_similar(bottomRight->color(), similarity) &&
+			bottomLeft->color().is_similar(topRight->color(), similarity))
 		{
 			//All colors are same in the square, remove diagonal edges
+			crossings++;
 			delete_edge(topLeft, BOTTOM_RIGHT);
 			delete_edge(bottomRight, TOP_LEFT);
 			delete_edge(topRight, BOTTOM_LEFT);
@@ -164,13 +175,13 @@ void Graph::curves_heuristic(IntPoint ip)
 
 	//Bigger curve is better, add difference to corresponding edge weight
 	if(featureA < featureB) {
-		weights[x+direction[RIGHT][0]][y+direction[RIGHT][1]][BOTTOM_LEFT] += (featureB - featureA);
-		weights[x+direction[BOTTOM][0]][y+direction[BOTTOM][1]][TOP_RIGHT] += (featureB - featureA);
+		weights[x+direction[RIGHT][0]][y+direction[RIGHT][1]][BOTTOM_LEFT] += heuristics.curves * (featureB - featureA);
+		weights[x+direction[BOTTOM][0]][y+direction[BOTTOM][1]][TOP_RIGHT] += heuristics.curves * (featureB - featureA);
 	}
 	else
 	{
-		weights[x][y][BOTTOM_RIGHT] += (featureA - featureB);
-		weights[x+direction[BOTTOM_RIGHT][0]][y+direction[BOTTOM_RIGHT][1]][TOP_LEFT] += (featureA - featureB);
+		weights[x][y][BOTTOM_RIGHT] += heuristics.curves * (featureA - featureB);
+		weights[x+direction[BOTTOM_RIGHT][0]][y+direction[BOTTOM_RIGHT][1]][TOP_LEFT] += heuristics.curves * (featureA - featureB);
 	}
 }
 
@@ -181,8 +192,8 @@ void Graph::islands_heuristic(IntPoint ip)
 	int y = Y(ip);
 	for(int i = 0; i < 8; i++) if(edge(x, y, (Direction)i))
 	{
-		weights[x][y][i] = 5 * ((valence(x,y) == 1) + (valence(x+direction[BOTTOM_RIGHT][0],y+direction[BOTTOM_RIGHT][1]) == 1));
-		weights[x+direction[i][0]][y+direction[i][1]][7-i] = 5 * ((valence(x,y) == 1) + (valence(x+direction[BOTTOM_RIGHT][0],y+direction[BOTTOM_RIGHT][1]) == 1));
+		weights[x][y][i] = heuristics.islands * ((valence(x,y) == 1) + (valence(x+direction[BOTTOM_RIGHT][0],y+direction[BOTTOM_RIGHT][1]) == 1));
+		weights[x+direction[i][0]][y+direction[i][1]][7-i] = heuristics.islands * ((valence(x,y) == 1) + (valence(x+direction[BOTTOM_RIGHT][0],y+direction[BOTTOM_RIGHT][1]) == 1));
 	}
 }
 
@@ -194,43 +205,43 @@ void Graph::sparse_pixels_heuristic(IntPoint ip)
 	//Measure the size of the connected component in a 8x8 box
 	if(!insideBounds(x+direction[RIGHT][0],y+direction[RIGHT][1],0,image->getWidth()-1,0, image->getHeight()-1)) return;
 	int labels[8][8] = {0};
-	std::stack<std::pair<int,int>> st;
+	//Every box position is labeled when pushed, so the stack never holds more than the 64 of them
+	std::pair<int,int> st[64];
+	int top = 0;
 	//Do DFS from (x,y) labeling 1 to each connected node.
-	st.push(std::make_pair(x,y));
+	st[top++] = std::make_pair(x,y);
 	labels[3][3] = 1; // Position of (X,Y) in the label array
-	while(!st.empty())
+	while(top > 0)
 	{
-		std::pair<int,int> point = st.top();
+		std::pair<int,int> point = st[--top];
 		int p = point.first;
 		int q = point.second;
-		st.pop();
 		for(int i = 0 ; i < 8; i++)
 		{
 			//See in all directions, scan for points that are in the not yet visited, in the 8x8 box, and have an edge from the current point.
 			if(!insideBounds(p+direction[i][0],q+direction[i][1],0,image->getWidth()-1,0, image->getHeight()-1) || !insideBounds(p+direction[i][0],q+direction[i][1],x-3,x+4,y-3,y+4)) continue;
 			if(labels[3+p+direction[i][0]-x][3+q+direction[i][1]-y] != 0) continue;
 			if(!edge(p, q, (Direction)i)) continue;
-			st.push(std::make_pair(p+direction[i][0],q+direction[i][1]));
+			st[top++] = std::make_pair(p+direction[i][0],q+direction[i][1]);
 			labels[3+p+direction[i][0]-x][3+q+direction[i][1]-y] = 1;
 		}
 	}
 
-	st.push(std::make_pair(x+direction[RIGHT][0],y+direction[RIGHT][1]));
+	st[top++] = std::make_pair(x+direction[RIGHT][0],y+direction[RIGHT][1]);
 	labels[4][3] = 2;
 
-	while(!st.empty())
+	while(top > 0)
 	{
-		std::pair<int,int> point = st.top();
+		std::pair<int,int> point = st[--top];
 		int p = point.first;
 		int q = point.second;
-		st.pop();
 		for(int i = 0 ; i < 8; i++)
 		{
 			//See in all directions, scan for points that are in the not yet visited, in the 8x8 box, and have an edge from the current point.
 			if(!insideBounds(p+direction[i][0],q+direction[i][1],0,image->getWidth()-1,0, image->getHeight()-1) || !insideBounds(p+direction[i][0],q+direction[i][1],x-3,x+4,y-3,y+4)) continue;
 			if(labels[3+p+direction[i][0]-x][3+q+direction[i][1]-y] != 0) continue;
 			if(!edge(p, q, (Direction)i)) continue;
-			st.push(std::make_pair(p+direction[i][0],q+direction[i][1]));
+			st[top++] = std::make_pair(p+direction[i][0],q+direction[i][1]);
 			labels[3+p+direction[i][0]-x][3+q+direction[i][1]-y] = 2;
 		}
 	}
@@ -246,13 +257,13 @@ void Graph::sparse_pixels_heuristic(IntPoint ip)
 	//Smaller component is better
 	if(componentA > componentB)
 	{
-		weights[x+direction[RIGHT][0]][y+direction[RIGHT][1]][BOTTOM_LEFT] += (componentA-componentB);
-		weights[x+direction[BOTTOM][0]][y+direction[BOTTOM][1]][TOP_RIGHT] += (componentA-componentB);
+		weights[x+direction[RIGHT][0]][y+direction[RIGHT][1]][BOTTOM_LEFT] += heuristics.sparse * (componentA-componentB);
+		weights[x+direction[BOTTOM][0]][y+direction[BOTTOM][1]][TOP_RIGHT] += heuristics.sparse * (componentA-componentB);
 	}
 	else
 	{
-		weights[x][y][BOTTOM_RIGHT] += (componentB-componentA);
-		weights[x+direction[BOTTOM_RIGHT][0]][y+direction[BOTTOM_RIGHT][1]][TOP_LEFT] += (componentB-componentA);
+		weights[x][y][BOTTOM_RIGHT] += heuristics.sparse * (componentB-componentA);
+		weights[x+direction[BOTTOM_RIGHT][0]][y+direction[BOTTOM_RIGHT][1]][TOP_LEFT] += heuristics.sparse * (componentB-componentA);
 	}
 }
 
@@ -332,7 +343,7 @@ void printNonZeroWeights(const std::vector<std::vector<std::vector<int>>>& weigh
 }
 
 void printEdges2(
-	const std::set<std::pair<IntPoint, Direction>>& edges,
+	const Graph::EdgeSet& edges,
 	const std::vector<std::vector<std::vector<int>>>& weights,
 	int width, int height) {
 	// Initialize a 2D vector to hold the cells for each pixel in the image
@@ -394,48 +405,78 @@ void printEdges2(
 	}
 }
 
-void Graph::planarize()
+bool Graph::needsHeuristics(int i, int j)
+{
+	Pixel* topLeft = (*image)(i, j);
+	Pixel* topRight = (*image).getAdjacent(i, j, RIGHT);
+	Pixel* bottomLeft = (*image).getAdjacent(i, j, BOTTOM);
+	Pixel* bottomRight = (*image).getAdjacent(i, j, BOTTOM_RIGHT);
+	if (!(topLeft && topRight && bottomLeft && bottomRight)) return false;
+	if(!edge(topLeft, BOTTOM_RIGHT) || !edge(topRight, BOTTOM_LEFT)) return false;
+
+	//Edges are crossing and the pixels are dissimilar, need to discard atleast one.
+	//Check if there are horizontal/vertical connections
+	return !edge(topLeft, BOTTOM) && !edge(topLeft, RIGHT) && !edge(bottomRight, TOP) && !edge(bottomRight, LEFT);
+}
+
+int Graph::weighCrossings(Heuristic heuristic)
+{
+	int squares = 0;
+	for(int i = 0 ; i < this->image->getWidth() - 1; i++) for(int j = 0 ; j < this->image->getHeight() - 1; j++)
+	{
+		if(!needsHeuristics(i, j)) continue;
+		squares++;
+		Pixel* topLeft = (*image)(i, j);
+		if(heuristic == ISLANDS)
+		{
+			islands_heuristic(*topLeft);
+			islands_heuristic(*(*image).getAdjacent(i, j, RIGHT));
+		}
+		else if(heuristic == CURVES) curves_heuristic(*topLeft);
+		else sparse_pixels_heuristic(*topLeft);
+	}
+	return squares;
+}
+
+void Graph::planarize(bool dumpEdges, StageTimes* times)
 {
 	//Remove Crosses for obvious planarization
 	remove_cross();
+	if(times) times->lap("remove_cross");
 	//For Internal Pixels, process via heuristic if edges are crossing
 	//A Pixel is the topLeft of a 2x2 box
 	for(int i = 0 ; i < this->image->getWidth() - 1; i++) for(int j = 0 ; j < this->image->getHeight() - 1; j++)
 	{
+		if(!needsHeuristics(i, j)) continue;
 		Pixel* topLeft = (*image)(i, j);
 		Pixel* topRight = (*image).getAdjacent(i, j, RIGHT);
 		Pixel* bottomLeft = (*image).getAdjacent(i, j, BOTTOM);
 		Pixel* bottomRight = (*image).getAdjacent(i, j, BOTTOM_RIGHT);
-		if (!(topLeft && topRight && bottomLeft && bottomRight)) continue;
-		if(edge(topLeft, BOTTOM_RIGHT) && edge(topRight, BOTTOM_LEFT))
+		//Run heuristics for weight
+		crossings++;
+		islands_heuristic(*topLeft);
+		islands_heuristic(*topRight);
+		curves_heuristic(*topLeft);
+		//curves_heuristic(*topRight);
+		sparse_pixels_heuristic(*topLeft);
+		//sparse_pixels_heuristic(*topRight);
+
+		//Remove the lighter edge. And both if they are equal
+		if(this->weights[topLeft->X()][topLeft->Y()][BOTTOM_RIGHT] <= this->weights[topRight->X()][topRight->Y()][BOTTOM_LEFT])
 		{
-			//Edges are crossing and the pixels are dissimilar, need to discard atleast one.
-			//Check if there are horizontal/vertical connections
-			if(edge(topLeft, BOTTOM)) continue;
-			if(edge(topLeft, RIGHT)) continue;
-			if(edge(bottomRight, TOP)) continue;
-			if(edge(bottomRight, LEFT)) continue;
-
-			//Run heuristics for weight
-			islands_heuristic(*topLeft);
-			islands_heuristic(*topRight);
-			curves_heuristic(*topLeft);
-			//curves_heuristic(*topRight);
-			sparse_pixels_heuristic(*topLeft);
-			//sparse_pixels_heuristic(*topRight);
-
-			//Remove the lighter edge. And both if they are equal
-			if(this->weights[topLeft->X()][topLeft->Y()][BOTTOM_RIGHT] <= this->weights[topRight->X()][topRight->Y()][BOTTOM_LEFT])
-			{
-				delete_edge(topLeft, BOTTOM_RIGHT);
-				delete_edge(bottomRight, TOP_LEFT);
-			}
-			if(this->weights[topLeft->X()][topLeft->Y()][BOTTOM_RIGHT] >= this->weights[topRight->X()][topRight->Y()][BOTTOM_LEFT])
-			{
-				delete_edge(topRight, BOTTOM_LEFT);
-				delete_edge(bottomLeft, TOP_RIGHT);
-			}
+			delete_edge(topLeft, BOTTOM_RIGHT);
+			delete_edge(bottomRight, TOP_LEFT);
 		}
+		if(this->weights[topLeft->X()][topLeft->Y()][BOTTOM_RIGHT] >= this->weights[topRight->X()][topRight->Y()][BOTTOM_LEFT])
+		{
+			delete_edge(topRight, BOTTOM_LEFT);
+			delete_edge(bottomLeft, TOP_RIGHT);
+		}
+	}
+	if(times) times->lap("planarize");
+	if(dumpEdges)
+	{
+		printEdges2(edges, weights, image->getWidth(), image->getHeight());
+		if(times) times->lap("dumpEdges");
 	}
-	printEdges2(edges, weights, image->getWidth(), image->getHeight());
 }
\ No newline at end of file
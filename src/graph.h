@@ -5,23 +5,47 @@
 
 #include "common.h"
 #include "image.h"
+#include "arena.h"
+#include "stats.h"
 
 //Graph Class, for handling similarity graphs and planarization
 
+//Factors of the planarization heuristics, larger ones make a heuristic count for more
+struct HeuristicWeights
+{
+	int islands = 5;
+	int curves = 1;
+	int sparse = 1;
+	bool operator==(const HeuristicWeights& w) const {return islands == w.islands && curves == w.curves && sparse == w.sparse;}
+	bool operator!=(const HeuristicWeights& w) const {return !(*this == w);}
+};
+
 class Graph
 {
+	public:
+		//Set of edges, kept in the arena of the graph
+		typedef std::set<std::pair<IntPoint, Direction>, std::less<std::pair<IntPoint, Direction> >,
+			ArenaAllocator<std::pair<IntPoint, Direction> > > EdgeSet;
+	private:
 	//Reference to image
 	Image* image;
 
+	//When two neighbouring pixels are connected, and how the crossing diagonals are resolved
+	SimilarityThresholds similarity;
+	HeuristicWeights heuristics;
+
+	//Holds the edge set, reset along with it
+	Arena arena;
+
 	//Edges of the graph in the form of pixel and 8 possible edges
-	std::set<std::pair<IntPoint, Direction>> edges;
+	EdgeSet edges;
 
-	//Weights for above
+	//Crossing diagonals resolved by planarize
+	int crossings;
+
+	//Weights for above, weights[x][y] for pixel (x,y). The grid may be larger than the image, see reset.
 	std::vector<std::vector<std::vector<int>>> weights;
 	
-	//For removing trivial cross edge non-planarity
-	void remove_cross();
-
 	//Heuristics for features
 	void curves_heuristic(IntPoint);
 	void sparse_pixels_heuristic(IntPoint);
@@ -30,26 +54,54 @@ class Graph
 	//How many edges for the pixel (x,y)
 	int valence(int x,int y);
 
+	//True if the diagonals of the 2x2 square with top-left pixel (i,j) cross without a horizontal or
+	//vertical connection, the squares planarize runs the heuristics on
+	bool needsHeuristics(int i, int j);
+
 	public:
 		//Default Constructor
 		Graph()
 		{
 			image = nullptr;
-			edges.clear();
-			weights.clear();
+			crossings = 0;
 		}
 
+		Graph(const Graph&) = delete;
+		Graph& operator=(const Graph&) = delete;
+
 		//Parametric Constructor
-		Graph(Image& image);
+		Graph(Image& image, const SimilarityThresholds& similarity = SimilarityThresholds(), const HeuristicWeights& heuristics = HeuristicWeights());
+
+		//Rebuilds the unplanarized graph of image, reusing the weight buffers of the previous one
+		void reset(Image& image, const SimilarityThresholds& similarity = SimilarityThresholds(), const HeuristicWeights& heuristics = HeuristicWeights());
+
+		//For removing trivial cross edge non-planarity, the first step of planarize
+		void remove_cross();
 
-		void planarize();
+		//Planarization heuristics
+		enum Heuristic { ISLANDS, CURVES, SPARSE };
+
+		//Runs heuristic alone on every square planarize would run the heuristics on, adding to the weights
+		//without removing any edge. Returns the number of squares. For measuring the heuristics.
+		int weighCrossings(Heuristic heuristic);
+
+		//Resolves crossing diagonals, dumping the resulting edge grid to std::cout if asked to.
+		//Laps remove_cross, planarize and dumpEdges on times if given.
+		void planarize(bool dumpEdges = true, StageTimes* times = nullptr);
 		
 		//Accessors
 		Image* getImage() {return image;}
+		int getCrossings() const {return crossings;}
+
+		//Number of edges, every edge is stored once from each of its ends
+		int getEdgeCount() const {return edges.size() / 2;}
 
 		std::vector<std::vector<std::vector<int>>> getEdges()
 		{
-			return weights;
+			std::vector<std::vector<std::vector<int>>> grid;
+			for(int i = 0; i < image->getWidth(); i++)
+				grid.emplace_back(weights[i].begin(), weights[i].begin() + image->getHeight());
+			return grid;
 		}
 		
 		// Returns if there is an edge from (x,y) in kth direction
@@ -9,13 +9,19 @@
 
 bool ColorYUV::is_similar(const ColorYUV& c) const
 {
-    return is_similar_2(c, 0.0);
+    return is_similar(c, SimilarityThresholds());
+}
+bool ColorYUV::is_similar(const ColorYUV& c, const SimilarityThresholds& t) const
+{
+    return abs(Y - c.Y) < t.softness + t.Y \
+        && abs(U - c.U) < t.softness + t.U \
+        && abs(V - c.V) < t.softness + t.V;
 }
 bool ColorYUV::is_similar_2(const ColorYUV& c, double softness) const
 {
-    return abs(Y - c.Y) < softness + 48.0 \
-        && abs(U - c.U) < softness + 7.0 \
-        && abs(V - c.V) < softness + 6.0;
+    SimilarityThresholds t;
+    t.softness = softness;
+    return is_similar(c, t);
 }
 
 // Converting to YUV as per Wikipedia definitions
@@ -55,6 +61,16 @@ void Pixel::print(std::ostream& out)
 Image::Image(const std::string& file)
 {
     auto raw_data = BMP(file.c_str());
+    load(raw_data);
+}
+
+Image::Image(BMP& raw_data)
+{
+    load(raw_data);
+}
+
+void Image::load(BMP& raw_data)
+{
     this->width = raw_data.bmp_info_header.width;
     this->height = raw_data.bmp_info_header.height;
     this->pixels.resize(this->width);
@@ -70,6 +86,21 @@ Image::Image(const std::string& file)
     }
 }
 
+Image::Image(Image& source, unsigned int x0, unsigned int y0, unsigned int w, unsigned int h)
+{
+    this->width = w;
+    this->height = h;
+    this->pixels.resize(this->width);
+    for (int row = 0; row < this->width; row++) {
+        pixels[row].resize(this->height);
+        for (int col = 0; col < this->height; col++)
+        {
+            const Color& c = source(x0 + row, y0 + col)->color();
+            pixels[row][col] = Pixel(this, c.R, c.G, c.B, row, col);
+        }
+    }
+}
+
 std::map<Direction, std::pair<int, int>> direction_deltas = {
     {TOP_LEFT, std::make_pair(-1, -1)},
     {TOP, std::make_pair(0, -1)},
@@ -8,12 +8,26 @@
 #include <utility>
 #include "common.h"
 
+// Largest YUV differences at which two colors still count as similar
+struct SimilarityThresholds {
+    double Y = 48.0;
+    double U = 7.0;
+    double V = 6.0;
+    // Added to all three thresholds
+    double softness = 0.0;
+    bool operator==(const SimilarityThresholds& t) const {
+        return Y == t.Y && U == t.U && V == t.V && softness == t.softness;
+    }
+    bool operator!=(const SimilarityThresholds& t) const { return !(*this == t); }
+};
+
 // Color structures
 struct ColorYUV {
     double Y;
     double U;
     double V;
     bool is_similar(const ColorYUV&) const;
+    bool is_similar(const ColorYUV& c, const SimilarityThresholds& t) const;
     bool is_similar_2(const ColorYUV& c, double softness = 20.0) const;
 };
 struct Color {
@@ -24,6 +38,7 @@ struct Color {
     ColorYUV toYUV() const;
     operator ColorYUV() const { return this->toYUV(); };
     bool is_similar(const Color& c) const { return this->toYUV().is_similar((ColorYUV)c); };
+    bool is_similar(const Color& c, const SimilarityThresholds& t) const { return this->toYUV().is_similar((ColorYUV)c, t); };
     bool is_similar_2(const Color& c) const { return this->toYUV().is_similar_2((ColorYUV)c); };
     bool operator==(const Color& c) const { return this->is_similar(c); }
     bool operator<(const Color& c) const {
@@ -34,6 +49,7 @@ struct Color {
 };
 
 class Pixel;
+struct BMP;
 // Class Image: For handling Image loading and access to colors
 class Image
 {
@@ -41,11 +57,20 @@ class Image
 	unsigned int height;
 	// Bag of pixels in a linearized matrix form
     std::vector<std::vector<Pixel>> pixels;
+
+    //Builds the pixels from decoded bitmap data
+    void load(BMP& raw_data);
 	
 	public:
         //Parametric constructor, loads file image
         Image(const std::string& file);
 
+        //Parametric constructor, from a bitmap decoded already
+        Image(BMP& raw_data);
+
+        //Crop constructor, copies the w x h window at (x0,y0) of source. Pixels get window local positions.
+        Image(Image& source, unsigned int x0, unsigned int y0, unsigned int w, unsigned int h);
+
         //Accessor to random pixel by index
         Pixel* operator()(unsigned int i, unsigned int j);
 
@@ -3,26 +3,159 @@
 #include "graph.h"
 #include "voronoi.h"
 #include "spline.h"
+#include "tiled.h"
+#include "stats.h"
+#include "pipeline.h"
+#include "threadpool.h"
 
 #define PIXELS
 
 #include <GL/freeglut.h>
 #include <GL/gl.h>
 #include <iostream>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdio>
+#include <map>
+#include <mutex>
+#include <thread>
+
+#ifndef APIENTRY
+#define APIENTRY
+#endif
+#ifndef GL_ARRAY_BUFFER
+#define GL_ARRAY_BUFFER 0x8892
+#define GL_ELEMENT_ARRAY_BUFFER 0x8893
+#define GL_STATIC_DRAW 0x88E4
+#endif
 
 using namespace std;
-float IMAGE_SCALE = 1.0f;
+const float IMAGE_SCALE = 1.0f;
 
 uint8_t rotateLevel = 0;
 
-//Global vars for use in render()
-Image* gImage = nullptr;
-Graph* gSimilarity = nullptr;
-Voronoi* gDiagram = nullptr;
-Spline* gCurves = nullptr;
-vector<pair<vector<Point>,Color> > mainOutLine;
+//Image and cached stage results for use in render(), parameters are tuned with the keys listed in main
+Pipeline* gPipeline = nullptr;
+PipelineOptions gOptions;
+//Workers of the parallel stages, shared by every run
+ThreadPool* gPool = nullptr;
+//Tuning happened while the worker was busy, it reruns once the worker is done
+bool gRetune = false;
+std::thread gWorker;
+
+//Pipeline stages, published in this order by the background worker
+enum Stage { STAGE_PIXELS, STAGE_GRAPH, STAGE_CELLS, STAGE_CURVES, STAGE_COUNT };
+const char* gStageNames[STAGE_COUNT] = {"load", "planarize", "voronoi", "curves"};
+
+//Stages finished so far. Everything a stage produces is written before the count is released and
+//never touched by the worker again, so the viewer reads it without locks.
+std::atomic<int> gPublished(0);
+//Wall clock seconds of every published stage, negative for skipped ones
+double gStageSeconds[STAGE_COUNT];
+//Stages the viewer has built batches for
+int gShown = 0;
+
+//Tiled mode: cells are computed by a TiledVoronoi for the tiles the view covers only, without the
+//global graph and the curves. The view pans and zooms but never shows more image pixels than the
+//window has, so the cells held by the cache and the viewer stay bounded by the window size. Meant for
+//images too big to reshape at once.
+bool TILED = false;
+int TILE_SIZE = 64;
+//Cells of one tile in x-major order with the origin and size of the tile
+struct TileCells
+{
+	int x0, y0, width, height;
+	vector<vector<Point> > cells;
+};
+//Tiles the view needs, by index ty * tiles across + tx, and the tiles the worker finished. The worker
+//only serves the newest request. All guarded by gTileLock.
+std::mutex gTileLock;
+std::condition_variable gTileWake;
+vector<int> gTileRequest;
+bool gTileRequested = false;
+bool gStopTiles = false;
+vector<TileCells> gTileResults;
+//Tiles in view the viewer has cells for, and the number of tiles in view it is still waiting for
+map<int, TileCells> gTilesShown;
+int gTilesMissing = 0;
+//Size of the worker's tile cache, for the overlay
+std::atomic<size_t> gTileCacheBytes(0), gTileCacheCount(0);
+//Image position at the top left corner of the window and window pixels per image pixel, 0 until
+//the window size is known
+float gViewX = 0, gViewY = 0, gViewScale = 0;
+
+//Milliseconds between checks for newly published results
+const int POLL_MS = 30;
+//A poll is scheduled already
+bool gPolling = false;
+
+//Buffer object entry points of GL 1.5. They are looked up at run time because Windows only exports
+//GL 1.1, without them the arrays are drawn from client memory the same way.
+typedef void (APIENTRY *GenBuffersProc)(GLsizei n, GLuint* buffers);
+typedef void (APIENTRY *BindBufferProc)(GLenum target, GLuint buffer);
+typedef void (APIENTRY *BufferDataProc)(GLenum target, std::ptrdiff_t size, const void* data, GLenum usage);
+GenBuffersProc glGenBuffersPtr = nullptr;
+BindBufferProc glBindBufferPtr = nullptr;
+BufferDataProc glBufferDataPtr = nullptr;
+
+//Retained geometry drawn with a single call: vertex positions in window coordinates, one color
+//per vertex and, for indexed batches, the indices of the primitives
+struct Batch
+{
+	GLenum mode;
+	vector<float> xy;
+	vector<GLubyte> rgb;
+	vector<GLuint> indices;
+	//Buffer objects of xy, rgb and indices, 0 while the arrays are drawn from client memory
+	GLuint buffers[3] = {0, 0, 0};
+
+	Batch(GLenum mode) : mode(mode) {}
+
+	void clear()
+	{
+		xy.clear();
+		rgb.clear();
+		indices.clear();
+	}
+
+	//Appends a vertex at image position (px, py)
+	void add(float px, float py, const Color& c);
+
+	//Copies the arrays into buffer objects if the driver has them
+	void upload();
+
+	void draw() const;
+
+	int vertexCount() const {return xy.size() / 2;}
+};
+
+//Cells as triangles, active edges and flattened splines as line pairs
+Batch gCells(GL_TRIANGLES), gEdges(GL_LINES), gSplineLines(GL_LINES);
+//Raw pixels and the similarity graph, shown until the cells are ready
+Batch gPixels(GL_TRIANGLES), gGraph(GL_LINES);
+
+//Spline segments of the optimized curves, flattened for the current window size
+SplineBatch gSplines;
+vector<float> gSplineX, gSplineY;
+vector<int> gSplineOffsets;
+//Maximum distance in window pixels between a spline and its flattened polyline
+float FLATNESS = 0.2f;
+//Window pixels per image pixel the splines were flattened for
+float gSplineScale = 0.0f;
 
 int majorwindow;
+int gWindowWidth = 1, gWindowHeight = 1;
+
+//Time the pipeline stages took, shown by the overlay
+StageTimes gTimes;
+//Performance overlay, toggled with 'o'
+bool gOverlay = false;
+//Duration of the previous frame in seconds
+double gFrameTime = 0;
 
 //Pretty Print graph to std::cout
 void printGraph(Graph& g)
@@ -45,35 +178,73 @@ void printGraph(Graph& g)
 	}
 }
 
+void retune();
+void zoomView(float factor);
+
+//Changes the parameter of a tuning key, lower case lowers and upper case raises it. The overlay
+//shows the current values. Returns false for other keys.
+bool tune(unsigned char key)
+{
+	SimilarityThresholds& similarity = gOptions.similarity;
+	HeuristicWeights& heuristics = gOptions.heuristics;
+	switch(key)
+	{
+		case 'y':similarity.Y = max(similarity.Y - 4, 0.0); break;
+		case 'Y':similarity.Y += 4; break;
+		case 'u':similarity.U = max(similarity.U - 1, 0.0); break;
+		case 'U':similarity.U += 1; break;
+		case 'v':similarity.V = max(similarity.V - 1, 0.0); break;
+		case 'V':similarity.V += 1; break;
+		case 's':similarity.softness = max(similarity.softness - 1, 0.0); break;
+		case 'S':similarity.softness += 1; break;
+		case 'i':heuristics.islands = max(heuristics.islands - 1, 0); break;
+		case 'I':heuristics.islands += 1; break;
+		case 'c':heuristics.curves = max(heuristics.curves - 1, 0); break;
+		case 'C':heuristics.curves += 1; break;
+		case 'p':heuristics.sparse = max(heuristics.sparse - 1, 0); break;
+		case 'P':heuristics.sparse += 1; break;
+		case 'n':gOptions.optimize.iterations = max(gOptions.optimize.iterations - 4, 0); break;
+		case 'N':gOptions.optimize.iterations += 4; break;
+		default:return false;
+	}
+	return true;
+}
+
 //keyboard() for ESC functionality
 void keyboard(unsigned char key, int x, int y)
 {
 	switch(key)
   	{
-		case 27:exit(0);break;
+		case 27:glutLeaveMainLoop();break;
 		case 'r':rotateLevel = (rotateLevel + 1) % 4; break;
+		case 'o':gOverlay = !gOverlay; break;
+		case '+':if(TILED) zoomView(2.0f); break;
+		case '-':if(TILED) zoomView(0.5f); break;
+		default:if(!TILED && tune(key)) retune(); break;
   	}
+	//Nothing animates, so frames are only drawn when something changed
+	glutPostRedisplay();
 }
 
 //Converts (0,w) -> (-1, 1)
 float convCoordX(float x)
 {
-	return (2*x)/(IMAGE_SCALE*(gImage->getWidth())) - 1;
+	return (2*x)/(IMAGE_SCALE*(gPipeline->getImage()->getWidth())) - 1;
 }
 
 
 //Converts (0,h) -> (-1, 1)
 float convCoordY(float y)
 {
-	return (2*y)/(IMAGE_SCALE*(gImage->getHeight())) - 1;
+	return (2*y)/(IMAGE_SCALE*(gPipeline->getImage()->getHeight())) - 1;
 }
 
 // Converts {[0,width],[0, height]} -> {[-1,1], [-1,1]}
 // Map :: [0,0] -> [-1, 1]
 // Map :: [width, height] -> [1, -1]
 void draw(float px, float py) {
-	float width = gImage->getWidth();
-	float height = gImage->getHeight();
+	float width = gPipeline->getImage()->getWidth();
+	float height = gPipeline->getImage()->getHeight();
 	float x = (2 * px) / width - 1;
 	float y = 1 - (2 * py) / height;
 	glVertex2f(x, y);
@@ -83,36 +254,237 @@ void draw(Point p) {
 	draw(X(p), Y(p));
 }
 
-//Function to draw a closed convex polygon with fill color.
-void drawPolygon(vector<pair<float,float> > hull, float r, float g, float b)
+void Batch::add(float px, float py, const Color& c)
 {
-	glColor3f(r,g,b);
-	//Need to tessellate for handling concaves
-	glBegin(GL_POLYGON);
-	for (const auto& point : hull) draw(point);
-	if (hull.size()) draw(hull[0]);
-	glEnd();
+	//Same mapping as draw()
+	xy.push_back((2 * px) / gPipeline->getImage()->getWidth() - 1);
+	xy.push_back(1 - (2 * py) / gPipeline->getImage()->getHeight());
+	rgb.push_back(c.R);
+	rgb.push_back(c.G);
+	rgb.push_back(c.B);
+}
 
+void Batch::upload()
+{
+	if(!glGenBuffersPtr) return;
+	if(!buffers[0]) glGenBuffersPtr(3, buffers);
+	glBindBufferPtr(GL_ARRAY_BUFFER, buffers[0]);
+	glBufferDataPtr(GL_ARRAY_BUFFER, xy.size() * sizeof(float), xy.data(), GL_STATIC_DRAW);
+	glBindBufferPtr(GL_ARRAY_BUFFER, buffers[1]);
+	glBufferDataPtr(GL_ARRAY_BUFFER, rgb.size(), rgb.data(), GL_STATIC_DRAW);
+	glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+	glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, buffers[2]);
+	glBufferDataPtr(GL_ELEMENT_ARRAY_BUFFER, indices.size() * sizeof(GLuint), indices.data(), GL_STATIC_DRAW);
+	glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, 0);
 }
 
-// calculates 1(x1)+t(x2)+t^2(x3) for bspline points
-inline float evalBspline(float x1, float x2, float x3, float t) { return x1 + x2*t + x3*t*t; }
+void Batch::draw() const
+{
+	if(xy.empty()) return;
+	//With buffer objects bound the array pointers are offsets into them
+	bool retained = buffers[0] != 0;
+	glEnableClientState(GL_VERTEX_ARRAY);
+	glEnableClientState(GL_COLOR_ARRAY);
+	if(retained) glBindBufferPtr(GL_ARRAY_BUFFER, buffers[0]);
+	glVertexPointer(2, GL_FLOAT, 0, retained ? nullptr : xy.data());
+	if(retained) glBindBufferPtr(GL_ARRAY_BUFFER, buffers[1]);
+	glColorPointer(3, GL_UNSIGNED_BYTE, 0, retained ? nullptr : rgb.data());
+	if(indices.empty())
+	{
+		glDrawArrays(mode, 0, vertexCount());
+	}
+	else
+	{
+		if(retained) glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, buffers[2]);
+		glDrawElements(mode, indices.size(), GL_UNSIGNED_INT, retained ? nullptr : indices.data());
+		if(retained) glBindBufferPtr(GL_ELEMENT_ARRAY_BUFFER, 0);
+	}
+	if(retained) glBindBufferPtr(GL_ARRAY_BUFFER, 0);
+	glDisableClientState(GL_COLOR_ARRAY);
+	glDisableClientState(GL_VERTEX_ARRAY);
+}
 
-//Function to draw a q-u-b spline curve from 3 control points
-void drawSpline(pair<float,float> p1, pair<float,float> p2, pair<float,float> p3)
+//Looks up the buffer object functions if the context is GL 1.5 or later
+void loadBufferObjects()
 {
-	vector<vector<float>> matrix = gCurves->getSpline({p1,p2,p3});
-	//T is extroplated a little for intersecting pieces
+	int major = 0, minor = 0;
+	const char* version = (const char*)glGetString(GL_VERSION);
+	if(!version || std::sscanf(version, "%d.%d", &major, &minor) != 2) return;
+	if(major < 1 || (major == 1 && minor < 5)) return;
+	glGenBuffersPtr = (GenBuffersProc)glutGetProcAddress("glGenBuffers");
+	glBindBufferPtr = (BindBufferProc)glutGetProcAddress("glBindBuffer");
+	glBufferDataPtr = (BufferDataProc)glutGetProcAddress("glBufferData");
+	if(!glGenBuffersPtr || !glBindBufferPtr || !glBufferDataPtr) glGenBuffersPtr = nullptr;
+}
 
-	// parameter t that will generate all the points
-	float t = -0.1f;
+//Splits the simple polygon ring into triangles by ear clipping. Cells can be concave, so a fan
+//isn't enough. Appends the triangles as indices into ring, offset by base.
+void triangulate(const vector<Point>& ring, GLuint base, vector<GLuint>& out)
+{
+	int n = ring.size();
+	if(n < 3) return;
+	vector<int> left(n);
+	for(int i = 0; i < n; i++) left[i] = i;
+	float area = 0;
+	for(int i = 0; i < n; i++)
+	{
+		const Point& a = ring[i];
+		const Point& b = ring[(i + 1) % n];
+		area += X(a) * Y(b) - X(b) * Y(a);
+	}
+	float orientation = area < 0 ? -1.0f : 1.0f;
+	auto turn = [&](int a, int b, int c)
+	{
+		return orientation * ((X(ring[b]) - X(ring[a])) * (Y(ring[c]) - Y(ring[a])) - (Y(ring[b]) - Y(ring[a])) * (X(ring[c]) - X(ring[a])));
+	};
 
-	// increment t by steps
-	float step = 0.01f;
+	while(left.size() > 3)
+	{
+		int m = left.size();
+		bool clipped = false;
+		for(int i = 0; i < m && !clipped; i++)
+		{
+			int a = left[(i + m - 1) % m], b = left[i], c = left[(i + 1) % m];
+			float t = turn(a, b, c);
+			if(t < 0) continue;
+			//Points in the middle of a straight run cover nothing, drop them
+			if(t == 0)
+			{
+				left.erase(left.begin() + i);
+				clipped = true;
+				break;
+			}
+			//b is an ear if no other point lies in or on the triangle
+			bool ear = true;
+			for(int k = 0; k < m && ear; k++)
+			{
+				int p = left[k];
+				if(p == a || p == b || p == c || ring[p] == ring[a] || ring[p] == ring[b] || ring[p] == ring[c]) continue;
+				if(turn(a, b, p) >= 0 && turn(b, c, p) >= 0 && turn(c, a, p) >= 0) ear = false;
+			}
+			if(!ear) continue;
+			out.push_back(base + a);
+			out.push_back(base + b);
+			out.push_back(base + c);
+			left.erase(left.begin() + i);
+			clipped = true;
+		}
+		//Self touching leftovers, fan them like GL_POLYGON did
+		if(!clipped) break;
+	}
+	for(int k = 1; k + 1 < left.size(); k++)
+	{
+		out.push_back(base + left[0]);
+		out.push_back(base + left[k]);
+		out.push_back(base + left[k + 1]);
+	}
+}
 
-	// store x,y after multiplying with 1, t and t^2
-	float xcor, ycor;
-	for(;t<=1.1f; t+=step) draw(evalBspline(matrix[0][0],matrix[1][0],matrix[2][0],t), evalBspline(matrix[0][1],matrix[1][1],matrix[2][1],t));
+//Appends cell (x, y) with the given hull to gCells
+void addCell(int x, int y, const vector<Point>& hull)
+{
+	GLuint base = gCells.vertexCount();
+	for(const auto& point : hull) gCells.add(X(point), Y(point), (*gPipeline->getImage())(x, y)->color());
+	triangulate(hull, base, gCells.indices);
+}
+
+//Builds gPixels from the pixels of the rectangle [x0,x1) x [y0,y1)
+void buildPixels(int x0, int y0, int x1, int y1)
+{
+	Image& image = *gPipeline->getImage();
+	gPixels.clear();
+	for(int x = x0 ; x < x1; x++)
+	for(int y = y0 ; y < y1; y++)
+	{
+		const auto& color = image(x, y)->color();
+		GLuint base = gPixels.vertexCount();
+		gPixels.add(x, y, color);
+		gPixels.add(x + 1, y, color);
+		gPixels.add(x + 1, y + 1, color);
+		gPixels.add(x, y + 1, color);
+		GLuint quad[6] = {0, 1, 2, 0, 2, 3};
+		for(GLuint k : quad) gPixels.indices.push_back(base + k);
+	}
+	gPixels.upload();
+}
+
+//Appends the cells of tile to gCells
+void addTile(const TileCells& tile)
+{
+	for(int x = 0; x < tile.width; x++)
+		for(int y = 0; y < tile.height; y++)
+			addCell(tile.x0 + x, tile.y0 + y, tile.cells[x * tile.height + y]);
+}
+
+//Builds the batches of a newly published stage, they don't change with the window size
+void buildStage(int stage)
+{
+	Image& image = *gPipeline->getImage();
+	if(stage == STAGE_PIXELS)
+	{
+		//Tiled mode shows the pixels of the view only, see updateView
+		if(!TILED) buildPixels(0, 0, image.getWidth(), image.getHeight());
+	}
+	else if(stage == STAGE_GRAPH)
+	{
+		//Every edge once, from the pixel it leaves to the right or downwards
+		const Color lineColor = {128, 128, 255};
+		const Direction forward[4] = {RIGHT, BOTTOM_LEFT, BOTTOM, BOTTOM_RIGHT};
+		gGraph.clear();
+		for(int x = 0 ; x < image.getWidth(); x++)
+		for(int y = 0 ; y < image.getHeight(); y++)
+			for(Direction k : forward) if(gPipeline->getGraph().edge(x,y,k))
+			{
+				auto adjPixel = image.getAdjacent(x, y, k);
+				if(!adjPixel) continue;
+				gGraph.add(x + 0.5f, y + 0.5f, lineColor);
+				gGraph.add(adjPixel->X() + 0.5f, adjPixel->Y() + 0.5f, lineColor);
+			}
+		gGraph.upload();
+	}
+	else if(stage == STAGE_CELLS && !TILED)
+	{
+		gCells.clear();
+		for(int x = 0 ; x < image.getWidth(); x++)
+		for(int y = 0 ; y < image.getHeight(); y++)
+			addCell(x, y, gPipeline->getDiagram().getHull(x,y));
+		gCells.upload();
+	}
+	else if(stage == STAGE_CURVES)
+	{
+		gEdges.clear();
+		for(const auto& edge : gPipeline->getSpline().getActiveEdges())
+		{
+			const auto& color = (edge.second)->color();
+			gEdges.add(X(edge.first.first), Y(edge.first.first), color);
+			gEdges.add(X(edge.first.second), Y(edge.first.second), color);
+		}
+		gEdges.upload();
+	}
+}
+
+//Flattens all q-u-b spline segments of the traced curves for the given zoom, into gSplineX/gSplineY
+//and the line pairs of gSplineLines
+void sampleSplines(float scale)
+{
+	gSplineScale = scale;
+	//T is extroplated a little for intersecting pieces
+	gSplines.tessellate(FLATNESS, scale, -0.1f, 1.1f, gSplineX, gSplineY, gSplineOffsets);
+
+	//The points of all segments of a curve are joined into one strip
+	gSplineLines.clear();
+	for(int c = 0; c < gSplines.getCurveCount(); c++)
+	{
+		const auto& color = gSplines.getColor(c);
+		int from = gSplineOffsets[gSplines.getCurveBegin(c)];
+		int to = gSplineOffsets[gSplines.getCurveEnd(c)];
+		for(int k = from; k + 1 < to; k++)
+		{
+			gSplineLines.add(gSplineX[k], gSplineY[k], color);
+			gSplineLines.add(gSplineX[k + 1], gSplineY[k + 1], color);
+		}
+	}
+	gSplineLines.upload();
 }
 
 std::pair<float, float> getCenter(int x, int y, int width, int height) {
@@ -145,21 +517,91 @@ void drawLine(int x1, int y1, int x2, int y2, int width, int height) {
 	glVertex2f(cx2, cy2);
 }
 
+//Draws the frame time, the geometry drawn and the stage timings in the top left corner
+void drawOverlay(int drawCalls, int vertices, int triangles, int lineCount)
+{
+	vector<string> lines;
+	char line[128];
+	std::snprintf(line, sizeof(line), "frame %.2f ms, %d draw calls", gFrameTime * 1000, drawCalls);
+	lines.push_back(line);
+	std::snprintf(line, sizeof(line), "%d vertices, %d triangles, %d lines", vertices, triangles, lineCount);
+	lines.push_back(line);
+	for(int stage = 0; stage < gShown; stage++)
+	{
+		if(gStageSeconds[stage] < 0) continue;
+		std::snprintf(line, sizeof(line), "%-12s %8.2f ms", gStageNames[stage], gStageSeconds[stage] * 1000);
+		lines.push_back(line);
+	}
+	if(gShown < STAGE_COUNT) lines.push_back(string(gStageNames[gShown]) + " running");
+	if(TILED)
+	{
+		std::snprintf(line, sizeof(line), "%d tiles in view, %d computing", (int)gTilesShown.size() + gTilesMissing, gTilesMissing);
+		lines.push_back(line);
+		std::snprintf(line, sizeof(line), "%d tiles cached, %.1f MB", (int)gTileCacheCount.load(), gTileCacheBytes.load() / 1048576.0);
+		lines.push_back(line);
+		std::snprintf(line, sizeof(line), "zoom %.2f window px per pixel", gViewScale);
+		lines.push_back(line);
+	}
+	else
+	{
+		const SimilarityThresholds& similarity = gOptions.similarity;
+		const HeuristicWeights& heuristics = gOptions.heuristics;
+		std::snprintf(line, sizeof(line), "Y %g U %g V %g softness %g", similarity.Y, similarity.U, similarity.V, similarity.softness);
+		lines.push_back(line);
+		std::snprintf(line, sizeof(line), "islands %d curves %d sparse %d", heuristics.islands, heuristics.curves, heuristics.sparse);
+		lines.push_back(line);
+		std::snprintf(line, sizeof(line), "%d optimization sweeps", gOptions.optimize.iterations);
+		lines.push_back(line);
+	}
+	for(const auto& stage : gTimes.getStages())
+	{
+		std::snprintf(line, sizeof(line), "%-12s %8.2f ms", stage.name.c_str(), stage.wall * 1000);
+		lines.push_back(line);
+	}
+
+	//Window pixels to window coordinates
+	float px = 2.0f / gWindowWidth, py = 2.0f / gWindowHeight;
+	const int lineHeight = 15;
+	glEnable(GL_BLEND);
+	glBlendFunc(GL_SRC_ALPHA, GL_ONE_MINUS_SRC_ALPHA);
+	glColor4f(0.0f, 0.0f, 0.0f, 0.6f);
+	glRectf(-1, 1, -1 + 300 * px, 1 - (lines.size() * lineHeight + 8) * py);
+	glDisable(GL_BLEND);
+	glColor3f(1.0f, 1.0f, 1.0f);
+	for(int i = 0; i < lines.size(); i++)
+	{
+		glRasterPos2f(-1 + 6 * px, 1 - ((i + 1) * lineHeight) * py);
+		glutBitmapString(GLUT_BITMAP_8_BY_13, (const unsigned char*)lines[i].c_str());
+	}
+}
+
 //Render Function
 void display()
 {
+	auto start = std::chrono::steady_clock::now();
 	bool check = true;
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glClearColor(1.0,1.0,1.0,0.0);
 	// glEnable( GL_MULTISAMPLE );
 
+	//Batches are laid out over the whole window, the view of tiled mode maps a part of the image onto it
+	glMatrixMode(GL_MODELVIEW);
+	glLoadIdentity();
+	if(TILED && gViewScale > 0)
+	{
+		float width = gPipeline->getImage()->getWidth(), height = gPipeline->getImage()->getHeight();
+		float viewWidth = gWindowWidth / gViewScale, viewHeight = gWindowHeight / gViewScale;
+		glTranslatef((width - 2 * gViewX) / viewWidth - 1, 1 - (height - 2 * gViewY) / viewHeight, 0);
+		glScalef(width / viewWidth, height / viewHeight, 1);
+	}
+
 	//Print Image [PIXELS]
 #ifndef PIXELS
 	glBegin(GL_QUADS);
-	for(int x = 0 ; x < gImage->getWidth(); x++)
-	for(int y = 0 ; y < gImage->getHeight(); y++)
+	for(int x = 0 ; x < gPipeline->getImage()->getWidth(); x++)
+	for(int y = 0 ; y < gPipeline->getImage()->getHeight(); y++)
 	{
-		auto color = (*gImage)(x,y)->color();
+		auto color = (*gPipeline->getImage())(x,y)->color();
 		float r = color.R/255.0;
 		float g = color.G/255.0;
 		float b = color.B/255.0;
@@ -169,40 +611,29 @@ void display()
 	glEnd();
 #endif
 
-	//Draw Voronoi Diagrams
-	for(int x = 0 ; x < gImage->getWidth(); x++)
-	for(int y = 0 ; y < gImage->getHeight(); y++)
-	{
-		auto color = (*gImage)(x, y)->color();
-		float r = color.R / 255.0;
-		float g = color.G / 255.0;
-		float b = color.B / 255.0;
-		auto hull = (*gDiagram)(x,y);
+	//Until the cells are complete, the raw pixels and then the similarity graph stand in for them
+	vector<const Batch*> drawn;
+	bool cellsDone = TILED ? gViewScale > 0 && gTilesMissing == 0 : gShown > STAGE_CELLS;
+	if(!cellsDone) drawn.push_back(&gPixels);
 
-		//Fill Polygon
-		drawPolygon(hull, r,g,b);
-
-		//Draw boundaries of reshaped cells
-		/*glColor3f(0.0f, 0.0f, 0.0f);
-		glBegin(GL_LINE_LOOP);
-		for(const auto& point : hull) draw(point);
-		if(hull.size()) draw(hull[0]);
-		glEnd();*/
-	}
+	//Draw Voronoi Diagrams
+	drawn.push_back(&gCells);
+	if(!cellsDone && gShown > STAGE_GRAPH) drawn.push_back(&gGraph);
+	for(const Batch* batch : drawn) batch->draw();
 
 
 #if 0
 	// Print Similarity graph
 	glBegin(GL_LINES);
-	for(int x = 0 ; x < gImage->getWidth(); x++)
-	for(int y = 0 ; y < gImage->getHeight(); y++)
+	for(int x = 0 ; x < gPipeline->getImage()->getWidth(); x++)
+	for(int y = 0 ; y < gPipeline->getImage()->getHeight(); y++)
 	{
-		for(int k = 0 ; k < 8; k++) if(gSimilarity->edge(x,y,(Direction)k))
+		for(int k = 0 ; k < 8; k++) if(gPipeline->getGraph().edge(x,y,(Direction)k))
 		{
 			glColor3f(0.5,0.5,1.0);
-			auto adjPixel = gImage->getAdjacent(x, y, (Direction)k);
+			auto adjPixel = gPipeline->getImage()->getAdjacent(x, y, (Direction)k);
 			if (adjPixel) {
-				drawLine(x, y, adjPixel->X(), adjPixel->Y(), gImage->getWidth(), gImage->getHeight());
+				drawLine(x, y, adjPixel->X(), adjPixel->Y(), gPipeline->getImage()->getWidth(), gPipeline->getImage()->getHeight());
 			}
 				
 		}
@@ -210,128 +641,383 @@ void display()
 	glEnd();
 
 	//Draws Voronoi Points around the pixels
-	for(int x = 0 ; x < gImage->getWidth(); x++)
-	for(int y = 0 ; y < gImage->getHeight(); y++)
+	for(int x = 0 ; x < gPipeline->getImage()->getWidth(); x++)
+	for(int y = 0 ; y < gPipeline->getImage()->getHeight(); y++)
 	{
 		glColor3f(0.0f,0.0f,1.0f);
 		glPointSize(3);
 		glBegin(GL_POINTS);
-		for(const Point& pt : (*gDiagram)(x,y)) draw(pt);
+		for(const Point& pt : gPipeline->getDiagram()(x,y)) draw(pt);
 		glEnd();
 	}
 	
 #endif
 	//Draws active edges selected by Spline for curve tracing
 	glLineWidth(5.0);
-	glBegin(GL_LINES);
-	glColor3f(0.0,0.0,1.0);
-	for(auto edge : gCurves->getActiveEdges())
-	{
-		auto color = (edge.second)->color();
-		float r = color.R / 255.0;
-		float g = color.G / 255.0;
-		float b = color.B / 255.0;
-		glColor3f(r,g,b);
-		draw(edge.first.first);
-		draw(edge.first.second);
-	}
-	glEnd();
-
+	gEdges.draw();
+	drawn.push_back(&gEdges);
 	glLineWidth(1.0f);
 	
 	//Draw BSPLINE CURVES
 	#ifndef BSPLINE_OVERLAY
 	glLineWidth(10.0f);
-	for(pair<vector<Point>,Color> curve: mainOutLine)
-	{
-		auto points = curve.first;
-		auto color = curve.second;
-		if(points.size() < 2) continue;
-		float r = color.R/255.0;
-		float g = color.G/255.0;
-		float b = color.B/255.0;
-		glColor3f(r,g,b);
-		glBegin(GL_LINE_STRIP);
-		for(int i = 0; i < points.size()-2; i++)
-		{
-			drawSpline(points[i],points[(i+1)%points.size()],points[(i+2)%points.size()]);
-			//i++;
-		}
-		glEnd();
-		//break;
-	}
-	//drawSpline(make_pair(1.f,7.f),make_pair(1.25f,6.25f),make_pair(1.f,8.f));
+	gSplineLines.draw();
+	drawn.push_back(&gSplineLines);
 	glLineWidth(1.0f);
 	#endif
 
 	#ifdef FINAL
 	#endif
+	if(gOverlay)
+	{
+		glLoadIdentity();
+		int drawCalls = 0, vertices = 0, triangles = 0, lines = 0;
+		for(const Batch* batch : drawn)
+		{
+			if(batch->xy.empty()) continue;
+			drawCalls++;
+			vertices += batch->vertexCount();
+			if(batch->mode == GL_TRIANGLES) triangles += batch->indices.size() / 3;
+			else lines += batch->vertexCount() / 2;
+		}
+		drawOverlay(drawCalls, vertices, triangles, lines);
+	}
 	glutSwapBuffers();
+	gFrameTime = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
 }
 
 
 
-void idleFunction()
+//Window pixels per image pixel
+float windowScale()
 {
-	glutSetWindow(majorwindow);
+	return std::max(gWindowWidth / (float)gPipeline->getImage()->getWidth(), gWindowHeight / (float)gPipeline->getImage()->getHeight());
+}
+
+void poll(int);
+
+void schedulePoll()
+{
+	if(gPolling) return;
+	gPolling = true;
+	glutTimerFunc(POLL_MS, poll, 0);
+}
+
+//Pixel rectangle [x0,x1) x [y0,y1) the view of tiled mode shows
+void viewRect(int& x0, int& y0, int& x1, int& y1)
+{
+	Image& image = *gPipeline->getImage();
+	x0 = std::max((int)gViewX, 0);
+	y0 = std::max((int)gViewY, 0);
+	x1 = std::min((int)std::ceil(gViewX + gWindowWidth / gViewScale), (int)image.getWidth());
+	y1 = std::min((int)std::ceil(gViewY + gWindowHeight / gViewScale), (int)image.getHeight());
+}
+
+//Tiles across the image in tiled mode
+int tilesAcross()
+{
+	return (gPipeline->getImage()->getWidth() + TILE_SIZE - 1) / TILE_SIZE;
+}
+
+//Keeps the view of tiled mode within the image, drops the cells of tiles that left it and asks the
+//worker for the tiles that came into it. The view starts out fitting the image into the window, and
+//zooming out stops at one window pixel per image pixel.
+void updateView()
+{
+	Image& image = *gPipeline->getImage();
+	if(gViewScale == 0) gViewScale = std::min(gWindowWidth / (float)image.getWidth(), gWindowHeight / (float)image.getHeight());
+	gViewScale = std::max(gViewScale, 1.0f);
+	gViewX = std::max(0.0f, std::min(gViewX, image.getWidth() - gWindowWidth / gViewScale));
+	gViewY = std::max(0.0f, std::min(gViewY, image.getHeight() - gWindowHeight / gViewScale));
+
+	int x0, y0, x1, y1;
+	viewRect(x0, y0, x1, y1);
+	int across = tilesAcross();
+	vector<int> needed;
+	map<int, TileCells> kept;
+	for(int ty = y0 / TILE_SIZE; ty * TILE_SIZE < y1; ty++)
+		for(int tx = x0 / TILE_SIZE; tx * TILE_SIZE < x1; tx++)
+		{
+			int key = ty * across + tx;
+			auto shown = gTilesShown.find(key);
+			if(shown == gTilesShown.end()) needed.push_back(key);
+			else kept[key] = std::move(shown->second);
+		}
+	gTilesShown.swap(kept);
+	gTilesMissing = needed.size();
+
+	buildPixels(x0, y0, x1, y1);
+	gCells.clear();
+	for(const auto& tile : gTilesShown) addTile(tile.second);
+	gCells.upload();
+
+	//Replaces a request the worker hasn't finished, the tiles of it still in view are asked for again
+	{
+		std::lock_guard<std::mutex> guard(gTileLock);
+		gTileRequest.swap(needed);
+		gTileRequested = true;
+	}
+	gTileWake.notify_one();
+	if(gTilesMissing) schedulePoll();
 	glutPostRedisplay();
 }
 
+//Zooms the view of tiled mode by factor around the middle of the window
+void zoomView(float factor)
+{
+	float cx = gViewX + gWindowWidth / (2 * gViewScale);
+	float cy = gViewY + gWindowHeight / (2 * gViewScale);
+	gViewScale *= factor;
+	gViewX = cx - gWindowWidth / (2 * gViewScale);
+	gViewY = cy - gWindowHeight / (2 * gViewScale);
+	updateView();
+}
+
+//Arrow keys pan the view of tiled mode by a quarter of the window
+void special(int key, int x, int y)
+{
+	if(!TILED) return;
+	float stepX = gWindowWidth / (4 * gViewScale), stepY = gWindowHeight / (4 * gViewScale);
+	switch(key)
+	{
+		case GLUT_KEY_LEFT:gViewX -= stepX; break;
+		case GLUT_KEY_RIGHT:gViewX += stepX; break;
+		case GLUT_KEY_UP:gViewY -= stepY; break;
+		case GLUT_KEY_DOWN:gViewY += stepY; break;
+		default:return;
+	}
+	updateView();
+}
+
+//Keeps the spline flattening matched to the on screen size of an image pixel, and the view of
+//tiled mode to the window
+void reshape(int width, int height)
+{
+	glViewport(0, 0, width, height);
+	gWindowWidth = std::max(width, 1);
+	gWindowHeight = std::max(height, 1);
+	if(TILED) updateView();
+	if(gShown > STAGE_CURVES && windowScale() != gSplineScale) sampleSplines(windowScale());
+}
+
+//Picks up what the worker published since the last call and schedules a redraw if anything changed
+void poll(int)
+{
+	gPolling = false;
+	bool changed = false;
+	int published = gPublished.load(std::memory_order_acquire);
+	for(; gShown < published; gShown++)
+	{
+		buildStage(gShown);
+		if(gShown == STAGE_CURVES) sampleSplines(windowScale());
+		changed = true;
+	}
+
+	if(TILED && gViewScale > 0)
+	{
+		vector<TileCells> results;
+		{
+			std::lock_guard<std::mutex> guard(gTileLock);
+			results.swap(gTileResults);
+		}
+		int x0, y0, x1, y1;
+		viewRect(x0, y0, x1, y1);
+		int across = tilesAcross();
+		bool added = false;
+		for(TileCells& tile : results)
+		{
+			//Tiles of an older view may have left the view since
+			int key = (tile.y0 / TILE_SIZE) * across + tile.x0 / TILE_SIZE;
+			if(tile.x0 >= x1 || tile.x0 + tile.width <= x0 || tile.y0 >= y1 || tile.y0 + tile.height <= y0) continue;
+			if(gTilesShown.count(key)) continue;
+			addTile(tile);
+			gTilesShown[key] = std::move(tile);
+			gTilesMissing--;
+			added = true;
+		}
+		if(added)
+		{
+			gCells.upload();
+			changed = true;
+		}
+	}
+
+	if(changed) glutPostRedisplay();
+	if(gShown < STAGE_COUNT || gTilesMissing > 0) schedulePoll();
+	else if(gRetune) retune();
+}
+
+//Releases the results of stage after recording how long it took
+void publish(int stage, StageTimes& times)
+{
+	times.lap(gStageNames[stage]);
+	gStageSeconds[stage] = times.getStages().back().wall;
+	gPublished.store(stage + 1, std::memory_order_release);
+}
+
+//Runs the pipeline after loading on a background thread, and again with the stages affected whenever
+//the parameters are tuned. Results are owned by gPipeline, which outlives the worker.
+void runPipeline(PipelineOptions options)
+{
+	StageTimes times;
+	if(TILED)
+	{
+		gStageSeconds[STAGE_GRAPH] = gStageSeconds[STAGE_CURVES] = -1;
+		gPublished.store(STAGE_GRAPH + 1, std::memory_order_release);
+
+		//Cells are only computed for tiles the view asks for. The cache keeps the tiles of earlier views
+		//until it is over its budget, then it evicts the least recently shown ones.
+		Image& image = *gPipeline->getImage();
+		TiledVoronoi tiled(image, TILE_SIZE);
+		int across = tilesAcross();
+		bool first = true;
+		while(true)
+		{
+			vector<int> request;
+			{
+				std::unique_lock<std::mutex> guard(gTileLock);
+				gTileWake.wait(guard, []() { return gTileRequested || gStopTiles; });
+				if(gStopTiles) return;
+				request.swap(gTileRequest);
+				gTileRequested = false;
+			}
+			if(first) times.restart();
+			for(int key : request)
+			{
+				TileCells tile;
+				tile.x0 = (key % across) * TILE_SIZE;
+				tile.y0 = (key / across) * TILE_SIZE;
+				tile.width = min(TILE_SIZE, (int)image.getWidth() - tile.x0);
+				tile.height = min(TILE_SIZE, (int)image.getHeight() - tile.y0);
+				tiled.requestViewport(tile.x0, tile.y0, tile.x0 + tile.width, tile.y0 + tile.height);
+				tile.cells.reserve(tile.width * tile.height);
+				for(int x = 0; x < tile.width; x++)
+					for(int y = 0; y < tile.height; y++)
+						tile.cells.push_back(tiled.getHull(tile.x0 + x, tile.y0 + y));
+				gTileCacheBytes = tiled.getMemoryUsage();
+				gTileCacheCount = tiled.getTileCount();
+
+				std::lock_guard<std::mutex> guard(gTileLock);
+				gTileResults.push_back(std::move(tile));
+				//The view moved on, its request has every tile of it the viewer doesn't have yet
+				if(gTileRequested || gStopTiles) break;
+			}
+			if(first)
+			{
+				//The stage time is the one of the first view
+				publish(STAGE_CELLS, times);
+				gPublished.store(STAGE_COUNT, std::memory_order_release);
+				first = false;
+			}
+		}
+	}
+
+	//Stages that are still up to date are skipped, the viewer keeps the batches it built for them
+	gPipeline->run(options, gPool, [&](Pipeline::Stage stage)
+	{
+		if(stage == Pipeline::GRAPH) publish(STAGE_GRAPH, times);
+		else if(stage == Pipeline::VORONOI) publish(STAGE_CELLS, times);
+		else if(stage == Pipeline::OPTIMIZE)
+		{
+			//B-Splines are fit on the optimized outlines of the active edges
+			gSplines.build(gPipeline->getCurves());
+			publish(STAGE_CURVES, times);
+		}
+	});
+}
+
+//Starts the worker on the stages the tuned parameters affect. While the worker is busy, or the viewer
+//hasn't caught up with it yet, the request waits for poll to pick it up.
+void retune()
+{
+	if(gShown < STAGE_COUNT)
+	{
+		gRetune = true;
+		return;
+	}
+	gRetune = false;
+	unsigned stale = gPipeline->stale(gOptions);
+	if(!stale) return;
+	int first = STAGE_CURVES;
+	if(stale & (1u << Pipeline::GRAPH)) first = STAGE_GRAPH;
+	else if(stale & (1u << Pipeline::VORONOI)) first = STAGE_CELLS;
+
+	//The batches of the stages before first stay, the others are rebuilt as the worker publishes them
+	if(gWorker.joinable()) gWorker.join();
+	gShown = first;
+	gPublished.store(first, std::memory_order_relaxed);
+	gWorker = std::thread(runPipeline, gOptions);
+	schedulePoll();
+}
+
 void drawImage(int argc, char* argv[], int width, int height) {
 	glutInit(&argc, argv);
+	//Closing the window returns from the main loop, so main can wait for the worker
+	glutSetOption(GLUT_ACTION_ON_WINDOW_CLOSE, GLUT_ACTION_GLUTMAINLOOP_RETURNS);
 	glutInitDisplayMode(GLUT_RGB | GLUT_DOUBLE | GLUT_DEPTH);
 	glutInitWindowPosition(2, 2);
 	majorwindow = glutCreateWindow("Depixelize!");
 	glutKeyboardFunc(keyboard);
+	glutSpecialFunc(special);
 	glutInitWindowSize(width, height);
-	glutIdleFunc(idleFunction);
+	glutReshapeFunc(reshape);
 	glutDisplayFunc(display);
+	gTimes.lap("window");
+	loadBufferObjects();
+	poll(0);
 	glutMainLoop();
 }
 
 int main(int argc, char** argv)
 {
-	if(argc < 2)
+	string input;
+	for(int i = 1; i < argc; i++)
+	{
+		string arg = argv[i];
+		if(arg == "--tiled") TILED = true;
+		else if(arg == "--tile" && i + 1 < argc) TILE_SIZE = max(atoi(argv[++i]), 1);
+		else if(input.empty() && arg.compare(0, 2, "--") != 0) input = arg;
+	}
+	if(input.empty())
 	{
-		std::cout << "Usage: " << argv[0] << " <<image_path>>\n";
+		std::cout << "Usage: " << argv[0] << " [--tiled] [--tile n] <<image_path>>\n";
+		std::cout << "  --tiled    reshape only the tiles in view and skip the curves, for images too big to process\n";
+		std::cout << "             at once. Arrow keys pan, + and - zoom, down to one window pixel per image pixel\n";
+		std::cout << "  --tile n   tile size in pixels for --tiled (default " << TILE_SIZE << ")\n";
+		std::cout << "Keys: o toggles the performance overlay, Esc quits\n";
+		std::cout << "Tuning keys, lower case lowers and upper case raises, the overlay shows the values:\n";
+		std::cout << "  y u v s    similarity thresholds of Y, U, V and the softness added to all three\n";
+		std::cout << "  i c p      weights of the islands, curves and sparse pixels heuristics\n";
+		std::cout << "  n          spline optimization sweeps\n";
 		return 1;
 	}
 	//Image contains Pixel Data
-	Image inputImage = Image(string(argv[1]));
-	gImage = &inputImage;
-
-	////Create Similarity Graph
-	Graph similarity(inputImage);
-	gSimilarity = &similarity;
-	//Planarize the graph
-	similarity.planarize();
-
-	////Test planarized similarity graph
-	////printGraph(similarity);
-
-	//Create Voronoi diagram for reshaping the pixels
-	Voronoi diagram(inputImage);
-	gDiagram = &diagram;
-	diagram.createDiagram(similarity);
-	//diagram.printVoronoi();
-
-	////Create B-Splines on the end points of Voronoi edges.
-	Spline curves(&diagram);
-	gCurves = &curves;
-	curves.extractActiveEdges();
-	curves.calculateGraph();
-
-	//// Check the graph here
-
-	//// mainOutLine contains all the outline edges where we will fit the b-splines
-	mainOutLine = curves.printGraph();
-	////std::cout << mainOutLine << endl;
-	//Optimize B-Splines
-
-	//Output Image
+	StageTimes times;
+	Image inputImage = Image(input);
+	Pipeline pipeline(inputImage);
+	gPipeline = &pipeline;
+	ThreadPool pool;
+	gPool = &pool;
+	if(TILED) gStageNames[STAGE_CELLS] = "tiles";
+	publish(STAGE_PIXELS, times);
+
+	//The rest of the pipeline runs while the window shows what is ready. The edge grid is dumped
+	//for the first run only, not for every tuning step.
+	PipelineOptions first = gOptions;
+	first.dumpEdges = true;
 	#ifndef NO_RENDER
+	gWorker = std::thread(runPipeline, first);
 	drawImage(argc, argv, inputImage.getWidth(), inputImage.getHeight());
-	//draw_square(argc, argv, 50, 50);
+	{
+		std::lock_guard<std::mutex> guard(gTileLock);
+		gStopTiles = true;
+	}
+	gTileWake.notify_one();
+	gWorker.join();
+	#else
+	//Without a window there is no view to compute tiles for
+	gStopTiles = true;
+	runPipeline(first);
 	#endif
 	return 0;
-}
\ No newline at end of file
+}
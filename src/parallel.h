@@ -0,0 +1,56 @@
+#pragma once
+
+#ifndef _PARALLEL_H
+#define _PARALLEL_H
+
+#include "threadpool.h"
+
+#include <algorithm>
+#include <thread>
+
+//Helpers for running a stage's independent loop iterations on a ThreadPool
+
+//Number of threads worth starting, at least 1
+inline int hardwareThreads()
+{
+	unsigned n = std::thread::hardware_concurrency();
+	return n ? (int)n : 1;
+}
+
+//Number of chunks parallelRanges splits a loop into on pool, for sizing per chunk buffers. One per
+//worker, or 1 without a pool.
+inline int maxChunks(const ThreadPool* pool)
+{
+	return pool ? std::max(pool->size(), 1) : 1;
+}
+
+//Splits [begin, end) into contiguous chunks of at least grain iterations, at most maxChunks(pool) of
+//them, and calls fn(chunk, from, to) for each as a task of pool. The calling thread helps while it
+//waits, so this may be called from tasks of pool. Without a pool the loop runs on the calling thread
+//as one chunk. Chunk c always covers an earlier range than chunk c + 1, so results collected per chunk
+//can be concatenated in chunk order to match a serial loop.
+//Returns the number of chunks used.
+template<typename F>
+int parallelRanges(ThreadPool* pool, int begin, int end, int grain, F fn)
+{
+	int count = end - begin;
+	if(count <= 0) return 0;
+	int chunks = std::max(1, std::min(maxChunks(pool), count / std::max(grain, 1)));
+	if(chunks == 1)
+	{
+		fn(0, begin, end);
+		return 1;
+	}
+
+	TaskGroup group;
+	for(int c = 0; c < chunks; c++)
+	{
+		int from = begin + (long long)count * c / chunks;
+		int to = begin + (long long)count * (c + 1) / chunks;
+		pool->submit([=, &fn]() { fn(c, from, to); }, group);
+	}
+	pool->wait(group);
+	return chunks;
+}
+
+#endif
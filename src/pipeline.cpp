@@ -0,0 +1,135 @@
+#include "pipeline.h"
+
+const char* Pipeline::stageName(Stage stage)
+{
+	static const char* names[STAGE_COUNT] = {"planarize", "voronoi", "regions", "trace", "optimize"};
+	return names[stage];
+}
+
+//Adds the stages reading from the stages in mask, directly or not
+static unsigned withDownstream(unsigned mask)
+{
+	if(mask & (1u << Pipeline::GRAPH)) mask |= 1u << Pipeline::VORONOI;
+	if(mask & (1u << Pipeline::VORONOI)) mask |= (1u << Pipeline::REGIONS) | (1u << Pipeline::TRACE);
+	if(mask & (1u << Pipeline::TRACE)) mask |= 1u << Pipeline::OPTIMIZE;
+	return mask;
+}
+
+unsigned Pipeline::stale(const PipelineOptions& options) const
+{
+	unsigned mask = ~valid & ((1u << STAGE_COUNT) - 1);
+	if(options.similarity != current.similarity || options.heuristics != current.heuristics) mask |= 1u << GRAPH;
+	if(options.optimize != current.optimize) mask |= 1u << OPTIMIZE;
+	mask = withDownstream(mask);
+
+	//Regions that aren't asked for are left alone, a cached result is picked up again once they are
+	if(!options.mergeRegions) mask &= ~(1u << REGIONS);
+	return mask;
+}
+
+void Pipeline::invalidate(Stage stage)
+{
+	valid &= ~withDownstream(1u << stage);
+}
+
+void Pipeline::setImage(Image& image)
+{
+	this->image = &image;
+	valid = 0;
+}
+
+unsigned Pipeline::run(const PipelineOptions& options, ThreadPool* pool, const std::function<void(Stage)>& finished)
+{
+	unsigned mask = stale(options);
+	valid &= ~withDownstream(mask);
+	current = options;
+	times.restart();
+	auto done = [&](Stage stage)
+	{
+		valid |= 1u << stage;
+		if(!finished) return;
+		finished(stage);
+		//The callback's time isn't part of the next stage
+		times.skip();
+	};
+
+	//Every stage clears its object in place, keeping the buffers of the previous result
+	if(mask & (1u << GRAPH))
+	{
+		graph.reset(*image, options.similarity, options.heuristics);
+		times.lap("graph");
+		graph.planarize(options.dumpEdges, &times);
+		done(GRAPH);
+	}
+	if(mask & (1u << VORONOI))
+	{
+		diagram.reset(*image);
+		diagram.createDiagram(graph, &times);
+		done(VORONOI);
+	}
+	if(mask & (1u << REGIONS))
+	{
+		regions.mergeCells();
+		times.lap("mergeCells");
+		done(REGIONS);
+	}
+	if(mask & (1u << TRACE))
+	{
+		spline.setSimilarity(options.similarity);
+		spline.extractActiveEdges(pool);
+		times.lap("extractActiveEdges");
+		spline.calculateGraph();
+		times.lap("calculateGraph");
+		spline.printGraph(traced, pool);
+		times.lap("printGraph");
+		done(TRACE);
+	}
+	if(mask & (1u << OPTIMIZE))
+	{
+		//Copied into the buffers of the previous curves
+		resizeReusing(curves, traced.size(), spareCurves);
+		for(int i = 0; i < traced.size(); i++)
+		{
+			curves[i].first.assign(traced[i].first.begin(), traced[i].first.end());
+			curves[i].second = traced[i].second;
+		}
+		Spline::optimizeCurves(curves, options.optimize, &scratch, pool);
+		times.lap("optimize");
+		done(OPTIMIZE);
+	}
+	return mask;
+}
+
+StatCounts Pipeline::getCounts()
+{
+	StatCounts counts;
+	if(!image) return counts;
+	int width = image->getWidth(), height = image->getHeight();
+	counts.emplace_back("pixels", (long long)width * height);
+	if(valid & (1u << GRAPH))
+	{
+		counts.emplace_back("edges", graph.getEdgeCount());
+		counts.emplace_back("crossings", graph.getCrossings());
+	}
+	if(valid & (1u << VORONOI))
+	{
+		//Cells collapsed to fewer than 3 corners have no area and don't count
+		long long cells = 0, vertices = 0;
+		for(int x = 0; x < width; x++)
+			for(int y = 0; y < height; y++)
+			{
+				int corners = diagram.getHull(x, y).size();
+				cells += corners >= 3;
+				vertices += corners;
+			}
+		counts.emplace_back("cells", cells);
+		counts.emplace_back("vertices", vertices);
+	}
+	if(current.mergeRegions && (valid & (1u << REGIONS))) counts.emplace_back("regions", regions.getRegions().size());
+	if(valid & (1u << TRACE))
+	{
+		counts.emplace_back("activeEdges", spline.getActiveEdges().size());
+		counts.emplace_back("curves", traced.size());
+	}
+	return counts;
+}
@@ -0,0 +1,121 @@
+#pragma once
+
+#ifndef _PIPELINE_H
+#define _PIPELINE_H
+
+#include "graph.h"
+#include "voronoi.h"
+#include "region.h"
+#include "spline.h"
+#include "stats.h"
+
+class ThreadPool;
+
+#include <functional>
+#include <vector>
+
+//Parameters of all stages. A stage depends on its own parameters and on the results of the stages
+//it reads from, see Pipeline.
+struct PipelineOptions
+{
+	//Similarity graph, also decides which cell edges are traced
+	SimilarityThresholds similarity;
+	HeuristicWeights heuristics;
+	//Merge same colored cells into regions
+	bool mergeRegions = false;
+	//Spline optimization
+	OptimizeOptions optimize;
+	//Dump the planarized edge grid to std::cout, doesn't change any result
+	bool dumpEdges = false;
+};
+
+//Class Pipeline: Runs the stages on one image and keeps the result of every stage along with the
+//parameters it was computed with. Running again with changed parameters recomputes only the stages
+//they affect and the ones downstream: new similarity thresholds or heuristic weights rebuild
+//everything from the graph, while new optimization settings only rerun the optimization on the
+//cached traced curves. Stages depend on each other as
+//	GRAPH -> VORONOI -> REGIONS
+//	               \--> TRACE -> OPTIMIZE
+//All state lives in the object, so separate pipelines run concurrently. Switching a pipeline to another
+//image keeps the stage buffers, and the stages take their node based containers and scratch from
+//arenas that are reset rather than freed, so a long lived pipeline fed images of similar size
+//allocates little besides the curves and regions it hands out.
+
+class Pipeline
+{
+	public:
+		enum Stage { GRAPH, VORONOI, REGIONS, TRACE, OPTIMIZE, STAGE_COUNT };
+	private:
+	//Reference to image
+	Image* image;
+
+	//Parameters of the cached results
+	PipelineOptions current;
+
+	//Stage objects, regions and spline read from diagram
+	Graph graph;
+	Voronoi diagram;
+	Regions regions;
+	Spline spline;
+	//Curves as traced, and after optimization
+	std::vector<std::pair<std::vector<Point>,Color> > traced;
+	std::vector<std::pair<std::vector<Point>,Color> > curves;
+
+	//Scratch memory of the optimization, and optimized curves left over from larger images
+	Arena scratch;
+	std::vector<std::pair<std::vector<Point>,Color> > spareCurves;
+
+	//Bit 1 << stage is set for every stage whose result is up to date
+	unsigned valid;
+
+	//Cost of the steps of the last run, reused stages don't show up
+	StageTimes times;
+	public:
+		//Parametric Constructor, nothing runs until run is called
+		Pipeline(Image& image) : Pipeline() {this->image = &image;}
+
+		//Default Constructor, setImage binds an image
+		Pipeline() : image(nullptr), regions(&diagram), spline(&diagram), valid(0) {}
+
+		Pipeline(const Pipeline&) = delete;
+		Pipeline& operator=(const Pipeline&) = delete;
+
+		//Drops all cached results and binds the pipeline to image, which must outlive the next run
+		void setImage(Image& image);
+
+		//Returns the stages run would recompute for options, as a mask of 1 << stage bits
+		unsigned stale(const PipelineOptions& options) const;
+
+		//Brings all stages up to date with options and returns the mask of the recomputed ones. Active
+		//edges are extracted and the curves traced and optimized on pool if given, serially otherwise.
+		//finished is called with every stage right after it has been recomputed.
+		unsigned run(const PipelineOptions& options, ThreadPool* pool = nullptr,
+			const std::function<void(Stage)>& finished = std::function<void(Stage)>());
+
+		//Drops the cached results of stage and of every stage downstream of it
+		void invalidate(Stage stage = GRAPH);
+
+		//Accessors, the stage results are complete once run returns or finished is called for them.
+		//getRegions is nullptr unless regions were merged.
+		Image* getImage() {return image;}
+		const PipelineOptions& getOptions() const {return current;}
+		Graph& getGraph() {return graph;}
+		Voronoi& getDiagram() {return diagram;}
+		Regions* getRegions() {return current.mergeRegions ? &regions : nullptr;}
+		Spline& getSpline() {return spline;}
+		const std::vector<std::pair<std::vector<Point>,Color> >& getTracedCurves() const {return traced;}
+		std::vector<std::pair<std::vector<Point>,Color> >& getCurves() {return curves;}
+		//Steps of the last run and what they cost: graph, remove_cross, planarize, dumpEdges,
+		//createRegions, collapseValence2, centroids, mergeCells, extractActiveEdges, calculateGraph,
+		//printGraph and optimize, as far as they ran. Time spent in finished isn't counted.
+		const StageTimes& getTimes() const {return times;}
+
+		//Sizes of the results that are up to date, in stage order: pixels; edges and crossings resolved by
+		//the graph; cells with an area and their corners; regions if merged; active edges and curves
+		StatCounts getCounts();
+
+		//Stage names
+		static const char* stageName(Stage stage);
+};
+
+#endif
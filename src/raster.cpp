@@ -0,0 +1,320 @@
+#include "raster.h"
+#include "threadpool.h"
+#include "BMP.h"
+
+#include <algorithm>
+#include <cmath>
+
+Rasterizer::Rasterizer(int width, int height, float scale, const Color& background)
+{
+	this->width = std::max(width, 1);
+	this->height = std::max(height, 1);
+	this->scale = scale;
+	pixels.resize((size_t)this->width * this->height * 3);
+	for(size_t i = 0; i < pixels.size(); i += 3)
+	{
+		pixels[i] = background.R;
+		pixels[i + 1] = background.G;
+		pixels[i + 2] = background.B;
+	}
+}
+
+//Adds the area the line covers in every pixel of rows [ry0, ry1) to acc, whose rows are stride floats
+//wide and start at column bx0. Every pixel gets the change in coverage from its left neighbour, so a
+//running sum along a row yields the winding coverage of each pixel. The line must lie within span
+//columns from bx0.
+static void accumulateLine(float x0, float y0, float x1, float y1, int bx0, int span, int ry0, int ry1, float* acc, int stride)
+{
+	if(y0 == y1) return;
+	float dir = 1.0f;
+	if(y0 > y1)
+	{
+		std::swap(x0, x1);
+		std::swap(y0, y1);
+		dir = -1.0f;
+	}
+	x0 -= bx0;
+	x1 -= bx0;
+	float dxdy = (x1 - x0) / (y1 - y0);
+	int from = std::max(ry0, (int)std::floor(y0));
+	int to = std::min(ry1, (int)std::ceil(y1));
+	for(int y = from; y < to; y++)
+	{
+		float top = std::max((float)y, y0);
+		float bottom = std::min((float)(y + 1), y1);
+		float dy = bottom - top;
+		if(dy <= 0) continue;
+		float d = dy * dir;
+
+		//Where the line enters and leaves the row, clamped against rounding out of the span
+		float xa = std::min(std::max(x0 + (top - y0) * dxdy, 0.0f), (float)span);
+		float xb = std::min(std::max(x0 + (bottom - y0) * dxdy, 0.0f), (float)span);
+		float left = std::min(xa, xb);
+		float right = std::max(xa, xb);
+		float leftFloor = std::floor(left);
+		int li = (int)leftFloor;
+		int ri = (int)std::ceil(right);
+		float* row = acc + (size_t)(y - ry0) * stride;
+
+		if(ri <= li + 1)
+		{
+			//Crosses a single pixel, the part right of the mean crossing counts fully for the next one
+			float xm = 0.5f * (xa + xb) - leftFloor;
+			row[li] += d - d * xm;
+			row[li + 1] += d * xm;
+		}
+		else
+		{
+			//Crosses several pixels: quadratic ramps in the two end pixels, linear in between
+			float s = 1.0f / (right - left);
+			float lf = left - leftFloor;
+			float a0 = 0.5f * s * (1.0f - lf) * (1.0f - lf);
+			float rf = right - ri + 1.0f;
+			float am = 0.5f * s * rf * rf;
+			row[li] += d * a0;
+			if(ri == li + 2)
+			{
+				row[li + 1] += d * (1.0f - a0 - am);
+			}
+			else
+			{
+				float a1 = s * (1.5f - lf);
+				row[li + 1] += d * (a1 - a0);
+				for(int xi = li + 2; xi < ri - 1; xi++) row[xi] += d * s;
+				float a2 = a1 + (ri - li - 3) * s;
+				row[ri - 1] += d * (1.0f - a2 - am);
+			}
+			row[ri] += d * am;
+		}
+	}
+}
+
+void Rasterizer::addRing(const std::vector<Point>& ring)
+{
+	int n = ring.size();
+	for(int i = 0; i < n; i++)
+	{
+		const Point& a = ring[i];
+		const Point& b = ring[(i + 1) % n];
+		lines.push_back(Line{X(a) * scale, Y(a) * scale, X(b) * scale, Y(b) * scale});
+	}
+}
+
+void Rasterizer::pushShape(Shape& shape)
+{
+	shape.end = lines.size();
+	shape.minX = shape.minY = INFINITY;
+	shape.maxX = shape.maxY = -INFINITY;
+	for(int i = shape.begin; i < shape.end; i++)
+	{
+		const Line& l = lines[i];
+		shape.minX = std::min(shape.minX, std::min(l.x0, l.x1));
+		shape.maxX = std::max(shape.maxX, std::max(l.x0, l.x1));
+		shape.minY = std::min(shape.minY, std::min(l.y0, l.y1));
+		shape.maxY = std::max(shape.maxY, std::max(l.y0, l.y1));
+	}
+	//Nothing to cover if the shape is degenerate or entirely off the framebuffer
+	if(!(shape.minY < shape.maxY) || shape.maxY <= 0 || shape.minY >= height || shape.maxX <= 0 || shape.minX >= width)
+	{
+		lines.resize(shape.begin);
+		return;
+	}
+	shapes.push_back(shape);
+}
+
+void Rasterizer::fillPolygon(const std::vector<Point>& ring, const Color& color, bool tile)
+{
+	Shape shape{(int)lines.size(), 0, 0, 0, 0, 0, (uint8_t)color.R, (uint8_t)color.G, (uint8_t)color.B, false, tile};
+	addRing(ring);
+	pushShape(shape);
+}
+
+void Rasterizer::fillPolygon(const std::vector<std::vector<Point>>& rings, const Color& color, bool evenOdd, bool tile)
+{
+	Shape shape{(int)lines.size(), 0, 0, 0, 0, 0, (uint8_t)color.R, (uint8_t)color.G, (uint8_t)color.B, evenOdd, tile};
+	for(const auto& ring : rings) addRing(ring);
+	pushShape(shape);
+}
+
+void Rasterizer::strokePolyline(const float* xs, const float* ys, int count, float lineWidth, const Color& color)
+{
+	Shape shape{(int)lines.size(), 0, 0, 0, 0, 0, (uint8_t)color.R, (uint8_t)color.G, (uint8_t)color.B, false, false};
+	float half = 0.5f * lineWidth;
+	for(int i = 0; i + 1 < count; i++)
+	{
+		float ax = xs[i] * scale, ay = ys[i] * scale;
+		float bx = xs[i + 1] * scale, by = ys[i + 1] * scale;
+		float length = std::sqrt((bx - ax) * (bx - ax) + (by - ay) * (by - ay));
+		if(length == 0) continue;
+
+		//Every segment becomes a rectangle stretched by half the width past both ends, so neighbours
+		//overlap at the joints. The rectangles all wind the same way and the nonzero rule fills overlaps once.
+		float dx = (bx - ax) / length * half, dy = (by - ay) / length * half;
+		ax -= dx; ay -= dy;
+		bx += dx; by += dy;
+		float corners[4][2] = {{ax - dy, ay + dx}, {bx - dy, by + dx}, {bx + dy, by - dx}, {ax + dy, ay - dx}};
+		for(int k = 0; k < 4; k++)
+			lines.push_back(Line{corners[k][0], corners[k][1], corners[(k + 1) % 4][0], corners[(k + 1) % 4][1]});
+	}
+	pushShape(shape);
+}
+
+template<typename F>
+void Rasterizer::coverShape(const Shape& shape, int y0, int y1, std::vector<float>& acc, F visit) const
+{
+	int ry0 = std::max(y0, (int)std::floor(shape.minY));
+	int ry1 = std::min(y1, (int)std::ceil(shape.maxY));
+	if(ry0 >= ry1) return;
+	int bx0 = (int)std::floor(shape.minX);
+	int span = (int)std::ceil(shape.maxX) - bx0;
+	int stride = span + 2;
+
+	acc.assign((size_t)stride * (ry1 - ry0), 0.0f);
+	for(int i = shape.begin; i < shape.end; i++)
+	{
+		const Line& l = lines[i];
+		accumulateLine(l.x0, l.y0, l.x1, l.y1, bx0, span, ry0, ry1, acc.data(), stride);
+	}
+
+	//Columns left of the framebuffer still feed the running sum, they are just not visited
+	int last = std::min(span, width - bx0);
+	for(int y = ry0; y < ry1; y++)
+	{
+		const float* row = acc.data() + (size_t)(y - ry0) * stride;
+		float sum = 0;
+		for(int i = 0; i < last; i++)
+		{
+			sum += row[i];
+			if(bx0 + i < 0) continue;
+			float cover = std::fabs(sum);
+			if(shape.evenOdd)
+			{
+				cover = std::fmod(cover, 2.0f);
+				if(cover > 1.0f) cover = 2.0f - cover;
+			}
+			else if(cover > 1.0f) cover = 1.0f;
+			if(cover >= 1.0f / 512) visit(bx0 + i, y, cover);
+		}
+	}
+}
+
+void Rasterizer::renderBand(const int* shapeIds, int count, int y0, int y1, std::vector<float>& acc, std::vector<float>& tileSum)
+{
+	//Tiles add up their color and coverage per pixel. Where they cover less than the whole
+	//pixel, like along the image border, the framebuffer shows through.
+	bool tiles = false;
+	for(int k = 0; k < count; k++)
+	{
+		const Shape& shape = shapes[shapeIds[k]];
+		if(!shape.tile) continue;
+		if(!tiles) tileSum.assign((size_t)(y1 - y0) * width * 4, 0.0f);
+		tiles = true;
+		coverShape(shape, y0, y1, acc, [&](int x, int y, float cover)
+		{
+			float* t = tileSum.data() + ((size_t)(y - y0) * width + x) * 4;
+			t[0] += shape.r * cover;
+			t[1] += shape.g * cover;
+			t[2] += shape.b * cover;
+			t[3] += cover;
+		});
+	}
+	if(tiles)
+	{
+		for(size_t i = 0; i < (size_t)(y1 - y0) * width; i++)
+		{
+			const float* t = tileSum.data() + i * 4;
+			if(t[3] == 0) continue;
+			//Rounding may add up to a little more than full coverage
+			float norm = t[3] > 1.0f ? 1.0f / t[3] : 1.0f;
+			float keep = 1.0f - t[3] * norm;
+			uint8_t* p = pixels.data() + ((size_t)y0 * width + i) * 3;
+			for(int c = 0; c < 3; c++) p[c] = (uint8_t)(p[c] * keep + t[c] * norm + 0.5f);
+		}
+	}
+
+	for(int k = 0; k < count; k++)
+	{
+		const Shape& shape = shapes[shapeIds[k]];
+		if(shape.tile) continue;
+		coverShape(shape, y0, y1, acc, [&](int x, int y, float cover)
+		{
+			uint8_t* p = pixels.data() + ((size_t)y * width + x) * 3;
+			p[0] = (uint8_t)(p[0] + (shape.r - p[0]) * cover + 0.5f);
+			p[1] = (uint8_t)(p[1] + (shape.g - p[1]) * cover + 0.5f);
+			p[2] = (uint8_t)(p[2] + (shape.b - p[2]) * cover + 0.5f);
+		});
+	}
+}
+
+void Rasterizer::render(ThreadPool* pool)
+{
+	int bands = (height + BAND_HEIGHT - 1) / BAND_HEIGHT;
+
+	//Bin the shapes by the bands they touch, painting order is kept within every band.
+	//The shapes of band b are bandShapes[bandOffset[b]..bandOffset[b+1]).
+	std::vector<int> first(shapes.size()), last(shapes.size());
+	std::vector<int> bandOffset(bands + 1, 0);
+	for(int i = 0; i < shapes.size(); i++)
+	{
+		first[i] = std::max(0, (int)std::floor(shapes[i].minY)) / BAND_HEIGHT;
+		last[i] = std::min(height - 1, (int)std::ceil(shapes[i].maxY) - 1) / BAND_HEIGHT;
+		for(int b = first[i]; b <= last[i]; b++) bandOffset[b + 1]++;
+	}
+	for(int b = 0; b < bands; b++) bandOffset[b + 1] += bandOffset[b];
+	std::vector<int> bandShapes(bandOffset[bands]);
+	std::vector<int> fill(bandOffset.begin(), bandOffset.end() - 1);
+	for(int i = 0; i < shapes.size(); i++)
+		for(int b = first[i]; b <= last[i]; b++) bandShapes[fill[b]++] = i;
+
+	auto renderOne = [&](int b, std::vector<float>& acc, std::vector<float>& tileSum)
+	{
+		renderBand(bandShapes.data() + bandOffset[b], bandOffset[b + 1] - bandOffset[b],
+			b * BAND_HEIGHT, std::min(height, (b + 1) * BAND_HEIGHT), acc, tileSum);
+	};
+
+	if(!pool || pool->size() < 2)
+	{
+		std::vector<float> acc, tileSum;
+		for(int b = 0; b < bands; b++) renderOne(b, acc, tileSum);
+	}
+	else
+	{
+		TaskGroup group;
+		for(int b = 0; b < bands; b++)
+			pool->submit([&renderOne, b]()
+			{
+				std::vector<float> acc, tileSum;
+				renderOne(b, acc, tileSum);
+			}, group);
+		pool->wait(group);
+	}
+
+	lines.clear();
+	shapes.clear();
+}
+
+bool Rasterizer::writeBMP(const std::string& path) const
+{
+	try
+	{
+		BMP bmp(width, height, false);
+		//BMP rows run bottom up and store channels as BGR
+		for(int y = 0; y < height; y++)
+		{
+			const uint8_t* src = pixels.data() + (size_t)y * width * 3;
+			uint8_t* dst = bmp.data.data() + (size_t)(height - 1 - y) * width * 3;
+			for(int x = 0; x < width; x++)
+			{
+				dst[3 * x] = src[3 * x + 2];
+				dst[3 * x + 1] = src[3 * x + 1];
+				dst[3 * x + 2] = src[3 * x];
+			}
+		}
+		bmp.write(path.c_str());
+	}
+	catch(const std::exception&)
+	{
+		return false;
+	}
+	return true;
+}
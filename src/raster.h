@@ -0,0 +1,92 @@
+#pragma once
+
+#ifndef _RASTER_H
+#define _RASTER_H
+
+#include "image.h"
+
+class ThreadPool;
+
+#include <string>
+#include <vector>
+
+//Class Rasterizer: Headless CPU renderer for reshaped cells, regions and curves.
+//Shapes are queued in painting order and rendered in one go. The framebuffer is cut into bands of
+//rows that share nothing, so bands render in parallel and the result doesn't depend on the thread
+//count. Coverage is the exact area every edge sweeps through a pixel, accumulated along the row,
+//so edges come out anti-aliased without supersampling.
+
+class Rasterizer
+{
+	//Edge of a shape in framebuffer pixels
+	struct Line
+	{
+		float x0, y0, x1, y1;
+	};
+
+	//Shape to fill, its edges are lines[begin..end)
+	struct Shape
+	{
+		int begin, end;
+		float minX, minY, maxX, maxY;
+		uint8_t r, g, b;
+		bool evenOdd;
+		//Part of a set of shapes that don't overlap, see fillPolygon
+		bool tile;
+	};
+
+	int width, height;
+	//Framebuffer pixels per input unit
+	float scale;
+
+	std::vector<Line> lines;
+	std::vector<Shape> shapes;
+
+	//RGB framebuffer, top row first
+	std::vector<uint8_t> pixels;
+
+	//Rows per band, also the unit of parallel work
+	static const int BAND_HEIGHT = 32;
+
+	//Appends the edges of the closed ring to the shape being built
+	void addRing(const std::vector<Point>& ring);
+
+	//Ends the shape being built at the last edge, dropping it if it has nothing to cover
+	void pushShape(Shape& shape);
+
+	//Calls visit(x, y, coverage) for every framebuffer pixel of rows [y0, y1) the shape covers.
+	//acc is scratch space.
+	template<typename F>
+	void coverShape(const Shape& shape, int y0, int y1, std::vector<float>& acc, F visit) const;
+
+	//Composites the shapes of band rows [y0, y1): first the tiles, then the others in order.
+	//acc and tileSum are scratch space.
+	void renderBand(const int* shapeIds, int count, int y0, int y1, std::vector<float>& acc, std::vector<float>& tileSum);
+	public:
+		//Framebuffer of width x height pixels cleared to background. Queued coordinates are multiplied by scale.
+		Rasterizer(int width, int height, float scale = 1.0f, const Color& background = Color{255, 255, 255});
+
+		//Queues a polygon made of one or more closed rings. Overlapping rings fill once with the nonzero
+		//rule, or cancel out where they overlap an even number of times with the even-odd rule.
+		//Polygons queued as tiles must not overlap each other, like the cells or the regions. Their colors
+		//are summed weighted by coverage instead of painted over each other, so the edge shared by two
+		//tiles doesn't let the background show through. Tiles always end up below the other shapes.
+		void fillPolygon(const std::vector<Point>& ring, const Color& color, bool tile = false);
+		void fillPolygon(const std::vector<std::vector<Point>>& rings, const Color& color, bool evenOdd = true, bool tile = false);
+
+		//Queues a polyline stroked lineWidth framebuffer pixels wide, with square caps
+		void strokePolyline(const float* xs, const float* ys, int count, float lineWidth, const Color& color);
+
+		//Renders and drops the queued shapes. Bands run on pool if given, serially otherwise.
+		void render(ThreadPool* pool = nullptr);
+
+		//Writes the framebuffer as a 24 bit BMP. Returns false if the file couldn't be written.
+		bool writeBMP(const std::string& path) const;
+
+		//Accessors
+		int getWidth() const {return width;}
+		int getHeight() const {return height;}
+		const std::vector<uint8_t>& getPixels() const {return pixels;}
+};
+
+#endif
@@ -0,0 +1,113 @@
+#include "common.h"
+#include "image.h"
+#include "graph.h"
+#include "voronoi.h"
+#include "spline.h"
+#include "region.h"
+#include "raster.h"
+#include "pipeline.h"
+#include "threadpool.h"
+
+#include <iostream>
+#include <cstdlib>
+
+using namespace std;
+
+//Settings of the BMP output, the stages take a PipelineOptions
+struct RasterOptions
+{
+	//Framebuffer pixels per image pixel
+	unsigned scale = 4;
+	//Width of the curve strokes in framebuffer pixels
+	float strokeWidth = 1.0f;
+	//Maximum distance in framebuffer pixels between a spline and its flattened polyline
+	float flatness = 0.2f;
+};
+
+//Queues the reshaped cells, or the merged regions, as tiles and strokes the curves over them
+void drawImage(Rasterizer& raster, Pipeline& pipeline, const RasterOptions& options)
+{
+	Image& image = *pipeline.getImage();
+	if(pipeline.getRegions())
+	{
+		for(const Region& region : pipeline.getRegions()->getRegions()) raster.fillPolygon(region.rings, region.color, true, true);
+	}
+	else
+	{
+		for(int x = 0 ; x < image.getWidth(); x++)
+		for(int y = 0 ; y < image.getHeight(); y++)
+			raster.fillPolygon(pipeline.getDiagram().getHull(x,y), image(x,y)->color(), true);
+	}
+	if(options.strokeWidth <= 0) return;
+
+	//Consecutive segments of a curve meet where one ends and the next starts, so the points of
+	//all segments of a curve form one polyline
+	SplineBatch batch;
+	batch.build(pipeline.getCurves());
+	vector<float> xs, ys;
+	vector<int> offsets;
+	batch.tessellate(options.flatness, options.scale, 0.0f, 1.0f, xs, ys, offsets);
+	for(int c = 0; c < batch.getCurveCount(); c++)
+	{
+		int from = offsets[batch.getCurveBegin(c)];
+		int to = offsets[batch.getCurveEnd(c)];
+		if(to - from < 2) continue;
+		raster.strokePolyline(&xs[from], &ys[from], to - from, options.strokeWidth, batch.getColor(c));
+	}
+}
+
+int main(int argc, char** argv)
+{
+	std::string input;
+	PipelineOptions stages;
+	RasterOptions options;
+	//Worker threads, 0 picks one per hardware thread
+	int threads = 0;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--regions") stages.mergeRegions = true;
+		else if (arg == "--scale" && i + 1 < argc) options.scale = max(atoi(argv[++i]), 1);
+		else if (arg == "--stroke" && i + 1 < argc) options.strokeWidth = atof(argv[++i]);
+		else if (arg == "--flatness" && i + 1 < argc) options.flatness = atof(argv[++i]);
+		else if (arg == "--iterations" && i + 1 < argc) stages.optimize.iterations = atoi(argv[++i]);
+		else if (arg == "--tolerance" && i + 1 < argc) stages.optimize.tolerance = atof(argv[++i]);
+		else if (arg == "--threads" && i + 1 < argc) threads = atoi(argv[++i]);
+		else if (input.empty() && arg.compare(0, 2, "--") != 0) input = arg;
+		else {
+			std::cout << "Usage: " << argv[0] << " [--scale n] [--regions] [--stroke px] [--flatness px] [--iterations n] [--tolerance px] [--threads n] <<bmp filename without extension>>" << endl;
+			std::cout << "  --scale n       output pixels per image pixel (default " << options.scale << ")" << endl;
+			std::cout << "  --regions       fill merged regions instead of single cells" << endl;
+			std::cout << "  --stroke px     width of the curve strokes in output pixels, 0 disables them (default " << options.strokeWidth << ")" << endl;
+			std::cout << "  --flatness px   curve flattening tolerance in output pixels (default " << options.flatness << ")" << endl;
+			std::cout << "  --iterations n  spline optimization sweeps, 0 disables it (default " << stages.optimize.iterations << ")" << endl;
+			std::cout << "  --tolerance px  stop optimizing a curve once it moves less (default " << stages.optimize.tolerance << ")" << endl;
+			std::cout << "  --threads n     worker threads, 0 for one per core (default " << threads << ")" << endl;
+			return 1;
+		}
+	}
+	if (input.empty()) {
+		std::cout << "Missing arguments" << endl;
+		return 1;
+	}
+
+	std::string output_path = input + "_" + to_string(options.scale) + "x.bmp";
+	ThreadPool pool(threads);
+
+	//Image contains Pixel Data
+	Image inputImage = Image(input + ".bmp");
+
+	//Planarize the similarity graph, reshape the pixels, merge the regions if asked for and trace and
+	//optimize the curves along the Voronoi edges
+	Pipeline pipeline(inputImage);
+	pipeline.run(stages, &pool);
+
+	//Output Image
+	Rasterizer raster(options.scale * inputImage.getWidth(), options.scale * inputImage.getHeight(), options.scale);
+	drawImage(raster, pipeline, options);
+	raster.render(&pool);
+	if (!raster.writeBMP(output_path)) {
+		std::cout << "Couldn't write " << output_path << endl;
+		return 1;
+	}
+	return 0;
+}
@@ -0,0 +1,180 @@
+#include "region.h"
+
+#include <unordered_map>
+#include <algorithm>
+#include <cstdint>
+
+//Voronoi points lie on the quarter pixel lattice, so they can be keyed exactly by integers
+static uint64_t pointKey(const Point& p)
+{
+	uint32_t x = (uint32_t)(int32_t)(X(p) * 4.0f);
+	uint32_t y = (uint32_t)(int32_t)(Y(p) * 4.0f);
+	return ((uint64_t)x << 32) | y;
+}
+
+struct EdgeKey
+{
+	uint64_t from;
+	uint64_t to;
+	bool operator==(const EdgeKey& e) const { return from == e.from && to == e.to; }
+};
+
+struct EdgeKeyHash
+{
+	size_t operator()(const EdgeKey& e) const
+	{
+		return std::hash<uint64_t>()(e.from * 0x9E3779B97F4A7C15ULL ^ e.to);
+	}
+};
+
+typedef std::unordered_map<EdgeKey, int, EdgeKeyHash, std::equal_to<EdgeKey>, ArenaAllocator<std::pair<const EdgeKey, int> > > EdgeMap;
+
+//Union-Find root with path halving
+static int findRoot(ArenaVector<int>& parent, int i)
+{
+	while(parent[i] != i)
+	{
+		parent[i] = parent[parent[i]];
+		i = parent[i];
+	}
+	return i;
+}
+
+//Checks if b lies on the straight line through a and c
+static bool collinear(const Point& a, const Point& b, const Point& c)
+{
+	return (X(b) - X(a)) * (Y(c) - Y(b)) == (Y(b) - Y(a)) * (X(c) - X(b));
+}
+
+void Regions::mergeCells()
+{
+	//Scratch of the previous merge is gone with the locals that used it
+	arena.reset();
+	label.clear();
+	if(this->diagram == nullptr)
+	{
+		regions.clear();
+		return;
+	}
+
+	Image* imageRef = this->diagram->getImage();
+	int width = imageRef->getWidth();
+	int height = imageRef->getHeight();
+	int cells = width * height;
+
+	//Owner cell of every directed hull edge
+	EdgeMap owner(0, EdgeKeyHash(), std::equal_to<EdgeKey>(), &arena);
+	owner.reserve(cells * 8);
+	for(int x = 0; x < width; x++) for(int y = 0; y < height; y++)
+	{
+		const std::vector<Point>& hull = this->diagram->getHull(x, y);
+		for(int i = 0; i < hull.size(); i++)
+			owner[EdgeKey{ pointKey(hull[i]), pointKey(hull[(i + 1) % hull.size()]) }] = x * height + y;
+	}
+
+	//Union cells across shared edges when both sides have the very same color. Color::operator== is
+	//too loose here, it would flatten the shading of similar colors into one fill.
+	ArenaVector<int> parent(cells, &arena);
+	for(int i = 0; i < cells; i++) parent[i] = i;
+	for(int x = 0; x < width; x++) for(int y = 0; y < height; y++)
+	{
+		const std::vector<Point>& hull = this->diagram->getHull(x, y);
+		const Color& c = (*imageRef)(x, y)->color();
+		for(int i = 0; i < hull.size(); i++)
+		{
+			auto it = owner.find(EdgeKey{ pointKey(hull[(i + 1) % hull.size()]), pointKey(hull[i]) });
+			if(it == owner.end()) continue;
+			int other = it->second;
+			const Color& o = (*imageRef)(other / height, other % height)->color();
+			if(c.R != o.R || c.G != o.G || c.B != o.B) continue;
+			int a = findRoot(parent, x * height + y);
+			int b = findRoot(parent, other);
+			if(a != b) parent[std::max(a, b)] = std::min(a, b);
+		}
+	}
+
+	//Number the regions in the order of their first cell. Regions of the previous merge are overwritten,
+	//so their ring buffers get reused.
+	label.assign(cells, -1);
+	int count = 0;
+	for(int i = 0; i < cells; i++)
+	{
+		int root = findRoot(parent, i);
+		if(label[root] < 0)
+		{
+			label[root] = count++;
+			if(regions.size() < count) resizeReusing(regions, count, spare);
+			regions[count - 1].color = (*imageRef)(i / height, i % height)->color();
+		}
+		label[i] = label[root];
+	}
+	resizeReusing(regions, count, spare);
+	ArenaVector<int> ringCount(count, 0, &arena);
+
+	//Shared edge cancellation: an edge survives only if the cell across it belongs to another region
+	ArenaVector<Edge> boundary(&arena);
+	ArenaVector<int> boundaryRegion(&arena);
+	for(int x = 0; x < width; x++) for(int y = 0; y < height; y++)
+	{
+		const std::vector<Point>& hull = this->diagram->getHull(x, y);
+		int region = label[x * height + y];
+		for(int i = 0; i < hull.size(); i++)
+		{
+			const Point& l = hull[i];
+			const Point& r = hull[(i + 1) % hull.size()];
+			auto it = owner.find(EdgeKey{ pointKey(r), pointKey(l) });
+			if(it != owner.end() && label[it->second] == region) continue;
+			boundary.push_back(std::make_pair(l, r));
+			boundaryRegion.push_back(region);
+		}
+	}
+
+	//Chain the surviving edges into closed rings, edges leaving the same point of a region are linked
+	EdgeMap firstOut(0, EdgeKeyHash(), std::equal_to<EdgeKey>(), &arena);
+	firstOut.reserve(boundary.size());
+	ArenaVector<int> nextOut(boundary.size(), -1, &arena);
+	for(int e = boundary.size() - 1; e >= 0; e--)
+	{
+		EdgeKey key{ (uint64_t)boundaryRegion[e], pointKey(boundary[e].first) };
+		auto it = firstOut.find(key);
+		if(it != firstOut.end()) nextOut[e] = it->second;
+		firstOut[key] = e;
+	}
+
+	ArenaVector<bool> used(boundary.size(), false, &arena);
+	ArenaVector<Point> ring(&arena), simplified(&arena);
+	for(int e = 0; e < boundary.size(); e++)
+	{
+		if(used[e]) continue;
+		int region = boundaryRegion[e];
+		ring.clear();
+		int current = e;
+		while(current >= 0 && !used[current])
+		{
+			used[current] = true;
+			ring.push_back(boundary[current].first);
+
+			//Take any unused edge leaving the end point, the even-odd rule doesn't care how loops touching
+			//at a pinch point get split
+			auto it = firstOut.find(EdgeKey{ (uint64_t)region, pointKey(boundary[current].second) });
+			int next = it == firstOut.end() ? -1 : it->second;
+			while(next >= 0 && used[next]) next = nextOut[next];
+			current = next;
+		}
+
+		//Drop points in the middle of straight runs
+		simplified.clear();
+		for(int i = 0; i < ring.size(); i++)
+		{
+			const Point& prev = ring[(i + ring.size() - 1) % ring.size()];
+			const Point& next = ring[(i + 1) % ring.size()];
+			if(!collinear(prev, ring[i], next)) simplified.push_back(ring[i]);
+		}
+		if(simplified.size() < 3) continue;
+		std::vector<std::vector<Point> >& rings = regions[region].rings;
+		int k = ringCount[region]++;
+		if(k == rings.size()) resizeReusing(rings, k + 1, spareRings);
+		rings[k].assign(simplified.begin(), simplified.end());
+	}
+	for(int r = 0; r < count; r++) resizeReusing(regions[r].rings, ringCount[r], spareRings);
+}
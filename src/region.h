@@ -0,0 +1,54 @@
+#pragma once
+
+#ifndef _REGION_H
+#define _REGION_H
+
+#include "voronoi.h"
+
+#include <vector>
+
+//Class Regions: Merges connected Voronoi cells of the same color into region polygons
+
+//One merged region, drawn with the even-odd rule
+struct Region
+{
+	//Closed boundary loops, the outline as well as the holes
+	std::vector<std::vector<Point>> rings;
+	//Color shared by all cells of the region
+	Color color;
+};
+
+class Regions
+{
+	//Reference to Voronoi diagram
+	Voronoi* diagram;
+
+	//Merged regions
+	std::vector<Region> regions;
+
+	//Regions and rings left over from larger merges, kept for their buffers
+	std::vector<Region> spare;
+	std::vector<std::vector<Point>> spareRings;
+
+	//Region index of every pixel (x,y), stored as label[x * height + y]
+	std::vector<int> label;
+
+	//Scratch memory of mergeCells
+	Arena arena;
+	public:
+		//Parametric Constructor
+		Regions(Voronoi* d) : diagram(d) {};
+
+		Regions(const Regions&) = delete;
+		Regions& operator=(const Regions&) = delete;
+
+		//Unions cells sharing an edge with the same color and traces the outlines of the unions.
+		//Edges shared by two cells of the same region cancel out, what remains is the region boundary.
+		void mergeCells();
+
+		//Accessors
+		std::vector<Region>& getRegions() {return regions;}
+		int getLabel(int x, int y) const {return label[x * diagram->getImage()->getHeight() + y];}
+};
+
+#endif
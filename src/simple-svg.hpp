@@ -38,6 +38,15 @@ SOFTWARE, EVEN IF ADVISED OF THE POSSIBILITY OF SUCH DAMAGE.
 #include <string>
 #include <sstream>
 #include <fstream>
+#include <cstdio>
+#include <cmath>
+#include <unordered_map>
+
+#ifdef SIMPLE_SVG_ZLIB
+#include <zlib.h>
+#endif
+
+#include "format.h"
 
 #include <iostream>
 
@@ -52,6 +61,12 @@ namespace svg
         ss << attribute_name << "=\"" << value << unit << "\" ";
         return ss.str();
     }
+    inline std::string attribute(std::string const & attribute_name,
+        double value, std::string const & unit = "")
+    {
+        char buffer[FORMAT_BUFFER_SIZE];
+        return attribute_name + "=\"" + std::string(buffer, formatShortest(buffer, value)) + unit + "\" ";
+    }
     inline std::string elemStart(std::string const & element_name)
     {
         return "\t<" + element_name + " ";
@@ -65,6 +80,26 @@ namespace svg
         return "/>\n";
     }
 
+    // Appends a number with precision decimals, or in shortest round-trip form for a negative precision.
+    inline void appendNumber(std::string & out, double value, int precision)
+    {
+        char buffer[FORMAT_BUFFER_SIZE];
+        out.append(buffer, formatNumber(buffer, value, precision));
+    }
+    inline void appendAttribute(std::string & out, char const * name, double value, int precision)
+    {
+        out += name;
+        out += "=\"";
+        appendNumber(out, value, precision);
+        out += "\" ";
+    }
+    inline void appendPoint(std::string & out, double x, double y, int precision)
+    {
+        appendNumber(out, x, precision);
+        out += ',';
+        appendNumber(out, y, precision);
+    }
+
     // Quick optional return type.  This allows functions to return an invalid
     //  value if no good return is possible.  The user checks for validity
     //  before using the returned value.
@@ -133,6 +168,8 @@ namespace svg
         return optional<Point>(max);
     }
 
+    class Palette;
+
     // Defines the dimensions, scale, origin, and origin offset of the document.
     struct Layout
     {
@@ -140,11 +177,20 @@ namespace svg
 
         Layout(Dimensions const & dimensions = Dimensions(400, 300), Origin origin = BottomLeft,
             double scale = 1, Point const & origin_offset = Point(0, 0))
-            : dimensions(dimensions), scale(scale), origin(origin), origin_offset(origin_offset) { }
+            : dimensions(dimensions), scale(scale), origin(origin), origin_offset(origin_offset),
+            precision(SHORTEST_PRECISION), compact(false), palette(nullptr) { }
         Dimensions dimensions;
         double scale;
         Origin origin;
         Point origin_offset;
+        // Decimals of the coordinates in paths, polygons and polylines, negative for the shortest
+        // form that reads back as the same float.
+        int precision;
+        // Compact encoding: no XML prolog, a view box mapping the scaled coordinates back to the
+        // dimensions, every shape as a path of relative commands with coordinates rounded to
+        // precision decimals (at least 0), and palette colors as CSS classes.
+        bool compact;
+        Palette const * palette;
     };
 
     // Convert coordinates in user space to SVG native space.
@@ -174,6 +220,12 @@ namespace svg
         Serializeable() { }
         virtual ~Serializeable() { };
         virtual std::string toString(Layout const & layout) const = 0;
+        // Appends the serialized form to out. Shapes written in bulk override this to skip
+        // building a temporary string per call.
+        virtual void appendTo(std::string & out, Layout const & layout) const
+        {
+            out += toString(layout);
+        }
     };
 
     class Color : public Serializeable
@@ -207,14 +259,44 @@ namespace svg
             }
         }
         virtual ~Color() { }
-        std::string toString(Layout const &) const
+        std::string toString(Layout const & layout) const
+        {
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        // Packed 0xRRGGBB, -1 for transparent.
+        int key() const { return transparent ? -1 : (red << 16) | (green << 8) | blue; }
+        // Appends #rgb when every channel repeats its hex digit, #rrggbb otherwise.
+        void appendHex(std::string & out) const
+        {
+            static const char digits[] = "0123456789abcdef";
+            int channels[3] = { red, green, blue };
+            bool shorthand = true;
+            for (int c : channels)
+                shorthand = shorthand && (c >> 4) == (c & 15);
+            out += '#';
+            for (int c : channels)
+            {
+                out += digits[(c >> 4) & 15];
+                if (!shorthand)
+                    out += digits[c & 15];
+            }
+        }
+        void appendTo(std::string & out, Layout const &) const
         {
-            std::stringstream ss;
             if (transparent)
-                ss << "none";
-            else
-                ss << "rgb(" << red << "," << green << "," << blue << ")";
-            return ss.str();
+            {
+                out += "none";
+                return;
+            }
+            out += "rgb(";
+            out += std::to_string(red);
+            out += ',';
+            out += std::to_string(green);
+            out += ',';
+            out += std::to_string(blue);
+            out += ')';
         }
     private:
             bool transparent;
@@ -238,10 +320,17 @@ namespace svg
             : color(color) { }
         std::string toString(Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << attribute("fill", color.toString(layout));
-            return ss.str();
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        void appendTo(std::string & out, Layout const & layout) const
+        {
+            out += "fill=\"";
+            color.appendTo(out, layout);
+            out += "\" ";
         }
+        Color const & getColor() const { return color; }
     private:
         Color color;
     };
@@ -252,17 +341,29 @@ namespace svg
         Stroke(double width = -1, Color color = Color::Transparent, bool nonScalingStroke = false)
             : width(width), color(color), nonScaling(nonScalingStroke) { }
         std::string toString(Layout const & layout) const
+        {
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        void appendTo(std::string & out, Layout const & layout) const
         {
             // If stroke width is invalid.
             if (width < 0)
-                return std::string();
+                return;
 
-            std::stringstream ss;
-            ss << attribute("stroke-width", translateScale(width, layout)) << attribute("stroke", color.toString(layout));
+            out += "stroke-width=\"";
+            appendNumber(out, translateScale(width, layout), layout.precision);
+            out += "\" stroke=\"";
+            color.appendTo(out, layout);
+            out += "\" ";
             if (nonScaling)
-               ss << attribute("vector-effect", "non-scaling-stroke");
-            return ss.str();
+               out += "vector-effect=\"non-scaling-stroke\" ";
         }
+        bool valid() const { return width >= 0; }
+        double getWidth() const { return width; }
+        Color const & getColor() const { return color; }
+        bool isNonScaling() const { return nonScaling; }
     private:
         double width;
         Color color;
@@ -275,15 +376,136 @@ namespace svg
         Font(double size = 12, std::string const & family = "Verdana") : size(size), family(family) { }
         std::string toString(Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << attribute("font-size", translateScale(size, layout)) << attribute("font-family", family);
-            return ss.str();
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        void appendTo(std::string & out, Layout const & layout) const
+        {
+            appendAttribute(out, "font-size", translateScale(size, layout), layout.precision);
+            out += attribute("font-family", family);
         }
     private:
         double size;
         std::string family;
     };
 
+    // Colors of a compact document. Color i is shared through the CSS class "f<i>" as fill and
+    // "s<i>" as stroke, colors missing from the palette are written inline.
+    class Palette
+    {
+    public:
+        int add(Color const & color)
+        {
+            auto it = index.find(color.key());
+            if (it != index.end())
+                return it->second;
+            index.emplace(color.key(), (int)colors.size());
+            colors.push_back(color);
+            return (int)colors.size() - 1;
+        }
+        int find(Color const & color) const
+        {
+            auto it = index.find(color.key());
+            return it == index.end() ? -1 : it->second;
+        }
+        size_t size() const { return colors.size(); }
+        // Stroke rules come first so that a fill class given alongside overrides their fill:none.
+        void appendStyle(std::string & out) const
+        {
+            out += "<style>";
+            for (unsigned i = 0; i < colors.size(); ++i)
+            {
+                out += ".s";
+                out += std::to_string(i);
+                out += "{fill:none;stroke:";
+                colors[i].appendHex(out);
+                out += '}';
+            }
+            for (unsigned i = 0; i < colors.size(); ++i)
+            {
+                out += ".f";
+                out += std::to_string(i);
+                out += "{fill:";
+                colors[i].appendHex(out);
+                out += '}';
+            }
+            out += "</style>\n";
+        }
+    private:
+        std::vector<Color> colors;
+        std::unordered_map<int, int> index;
+    };
+
+    // Writes the points of compact paths as relative moves on the grid of layout.precision decimals.
+    // Every point is rounded on its own and the steps are taken between rounded points, so the
+    // rounding error never accumulates along a path.
+    class RelativeEncoder
+    {
+    public:
+        RelativeEncoder(std::string & out, Layout const & layout)
+            : out(out), layout(layout), decimals(layout.precision > 0 ? layout.precision : 0),
+            factor(std::pow(10.0, decimals)), x(0), y(0), start_x(0), start_y(0), separate(false) { }
+        // Starts a subpath, with an absolute M for the first one of the path.
+        void moveTo(Point const & point, bool first)
+        {
+            command(first ? 'M' : 'm');
+            if (first)
+                x = y = 0;
+            step(point);
+            start_x = x;
+            start_y = y;
+        }
+        void command(char c)
+        {
+            out += c;
+            separate = false;
+        }
+        // Appends the step from the current point to point and moves there.
+        void step(Point const & point)
+        {
+            long long px = quantizeX(point);
+            long long py = quantizeY(point);
+            number(px - x);
+            number(py - y);
+            x = px;
+            y = py;
+        }
+        // Appends the step from the current point to point without moving, for control points.
+        void offsetTo(Point const & point)
+        {
+            number(quantizeX(point) - x);
+            number(quantizeY(point) - y);
+        }
+        void close()
+        {
+            command('z');
+            x = start_x;
+            y = start_y;
+        }
+    private:
+        long long quantizeX(Point const & point) const { return std::llround(translateX(point.x, layout) * factor); }
+        long long quantizeY(Point const & point) const { return std::llround(translateY(point.y, layout) * factor); }
+        void number(long long value)
+        {
+            // A minus sign separates numbers as well as a space does
+            if (separate && value >= 0)
+                out += ' ';
+            char buffer[FORMAT_BUFFER_SIZE];
+            char * end = decimals ? formatFixed(buffer, value / factor, decimals) : formatInt(buffer, value);
+            out.append(buffer, end);
+            separate = true;
+        }
+
+        std::string & out;
+        Layout const & layout;
+        int decimals;
+        double factor;
+        long long x, y;
+        long long start_x, start_y;
+        bool separate;
+    };
+
     class Shape : public Serializeable
     {
     public:
@@ -295,6 +517,82 @@ namespace svg
     protected:
         Fill fill;
         Stroke stroke;
+
+        // Paint of a compact shape: palette classes where possible, inline attributes otherwise.
+        void appendCompactPaint(std::string & out, Layout const & layout) const
+        {
+            int fill_class = layout.palette ? layout.palette->find(fill.getColor()) : -1;
+            int stroke_class = (layout.palette && stroke.valid()) ? layout.palette->find(stroke.getColor()) : -1;
+            if (fill_class >= 0 || stroke_class >= 0)
+            {
+                out += " class=\"";
+                if (stroke_class >= 0)
+                {
+                    out += 's';
+                    out += std::to_string(stroke_class);
+                }
+                if (fill_class >= 0)
+                {
+                    if (stroke_class >= 0)
+                        out += ' ';
+                    out += 'f';
+                    out += std::to_string(fill_class);
+                }
+                out += '"';
+            }
+            // The stroke class already turns the fill off
+            if (fill_class < 0 && (stroke_class < 0 || fill.getColor().key() >= 0))
+            {
+                out += " fill=\"";
+                fill.getColor().appendTo(out, layout);
+                out += '"';
+            }
+            if (!stroke.valid())
+                return;
+            if (stroke_class < 0)
+            {
+                out += " stroke=\"";
+                stroke.getColor().appendTo(out, layout);
+                out += '"';
+            }
+            double width = translateScale(stroke.getWidth(), layout);
+            if (width != 1)
+            {
+                char buffer[FORMAT_BUFFER_SIZE];
+                out += " stroke-width=\"";
+                out.append(buffer, formatShortest(buffer, width));
+                out += '"';
+            }
+            if (stroke.isNonScaling())
+                out += " vector-effect=\"non-scaling-stroke\"";
+        }
+        // Compact form of a polygon or polyline, or of the subpaths of a path.
+        void appendCompactPath(std::string & out, Layout const & layout,
+            std::vector<Point> const * subpaths, size_t count, bool closed, bool even_odd) const
+        {
+            out += "<path d=\"";
+            RelativeEncoder encoder(out, layout);
+            bool first = true;
+            for (size_t k = 0; k < count; ++k)
+            {
+                std::vector<Point> const & subpath = subpaths[k];
+                if (subpath.empty())
+                    continue;
+                encoder.moveTo(subpath[0], first);
+                first = false;
+                if (subpath.size() > 1)
+                    encoder.command('l');
+                for (unsigned i = 1; i < subpath.size(); ++i)
+                    encoder.step(subpath[i]);
+                if (closed)
+                    encoder.close();
+            }
+            out += '"';
+            if (even_odd)
+                out += " fill-rule=\"evenodd\"";
+            appendCompactPaint(out, layout);
+            out += "/>\n";
+        }
     };
     template <typename T>
     inline std::string vectorToString(std::vector<T> collection, Layout const & layout)
@@ -314,12 +612,19 @@ namespace svg
             : Shape(fill, stroke), center(center), radius(diameter / 2) { }
         std::string toString(Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("circle") << attribute("cx", translateX(center.x, layout))
-                << attribute("cy", translateY(center.y, layout))
-                << attribute("r", translateScale(radius, layout)) << fill.toString(layout)
-                << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        void appendTo(std::string & out, Layout const & layout) const
+        {
+            out += elemStart("circle");
+            appendAttribute(out, "cx", translateX(center.x, layout), layout.precision);
+            appendAttribute(out, "cy", translateY(center.y, layout), layout.precision);
+            appendAttribute(out, "r", translateScale(radius, layout), layout.precision);
+            fill.appendTo(out, layout);
+            stroke.appendTo(out, layout);
+            out += emptyElemEnd();
         }
         void offset(Point const & offset)
         {
@@ -340,13 +645,20 @@ namespace svg
             radius_height(height / 2) { }
         std::string toString(Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("ellipse") << attribute("cx", translateX(center.x, layout))
-                << attribute("cy", translateY(center.y, layout))
-                << attribute("rx", translateScale(radius_width, layout))
-                << attribute("ry", translateScale(radius_height, layout))
-                << fill.toString(layout) << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        void appendTo(std::string & out, Layout const & layout) const
+        {
+            out += elemStart("ellipse");
+            appendAttribute(out, "cx", translateX(center.x, layout), layout.precision);
+            appendAttribute(out, "cy", translateY(center.y, layout), layout.precision);
+            appendAttribute(out, "rx", translateScale(radius_width, layout), layout.precision);
+            appendAttribute(out, "ry", translateScale(radius_height, layout), layout.precision);
+            fill.appendTo(out, layout);
+            stroke.appendTo(out, layout);
+            out += emptyElemEnd();
         }
         void offset(Point const & offset)
         {
@@ -368,13 +680,20 @@ namespace svg
             height(height) { }
         std::string toString(Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("rect") << attribute("x", translateX(edge.x, layout))
-                << attribute("y", translateY(edge.y, layout))
-                << attribute("width", translateScale(width, layout))
-                << attribute("height", translateScale(height, layout))
-                << fill.toString(layout) << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        void appendTo(std::string & out, Layout const & layout) const
+        {
+            out += elemStart("rect");
+            appendAttribute(out, "x", translateX(edge.x, layout), layout.precision);
+            appendAttribute(out, "y", translateY(edge.y, layout), layout.precision);
+            appendAttribute(out, "width", translateScale(width, layout), layout.precision);
+            appendAttribute(out, "height", translateScale(height, layout), layout.precision);
+            fill.appendTo(out, layout);
+            stroke.appendTo(out, layout);
+            out += emptyElemEnd();
         }
         void offset(Point const & offset)
         {
@@ -396,13 +715,19 @@ namespace svg
             end_point(end_point) { }
         std::string toString(Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("line") << attribute("x1", translateX(start_point.x, layout))
-                << attribute("y1", translateY(start_point.y, layout))
-                << attribute("x2", translateX(end_point.x, layout))
-                << attribute("y2", translateY(end_point.y, layout))
-                << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        void appendTo(std::string & out, Layout const & layout) const
+        {
+            out += elemStart("line");
+            appendAttribute(out, "x1", translateX(start_point.x, layout), layout.precision);
+            appendAttribute(out, "y1", translateY(start_point.y, layout), layout.precision);
+            appendAttribute(out, "x2", translateX(end_point.x, layout), layout.precision);
+            appendAttribute(out, "y2", translateY(end_point.y, layout), layout.precision);
+            stroke.appendTo(out, layout);
+            out += emptyElemEnd();
         }
         void offset(Point const & offset)
         {
@@ -430,16 +755,29 @@ namespace svg
         }
         std::string toString(Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("polygon");
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        void appendTo(std::string & out, Layout const & layout) const
+        {
+            if (layout.compact)
+            {
+                appendCompactPath(out, layout, &points, 1, true, false);
+                return;
+            }
 
-            ss << "points=\"";
+            out += "\t<polygon points=\"";
             for (unsigned i = 0; i < points.size(); ++i)
-                ss << translateX(points[i].x, layout) << "," << translateY(points[i].y, layout) << " ";
-            ss << "\" ";
+            {
+                appendPoint(out, translateX(points[i].x, layout), translateY(points[i].y, layout), layout.precision);
+                out += ' ';
+            }
+            out += "\" ";
 
-            ss << fill.toString(layout) << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            fill.appendTo(out, layout);
+            stroke.appendTo(out, layout);
+            out += "/>\n";
         }
         void offset(Point const & offset)
         {
@@ -474,25 +812,41 @@ namespace svg
 
        std::string toString(Layout const & layout) const
        {
-          std::stringstream ss;
-          ss << elemStart("path");
+          std::string str;
+          appendTo(str, layout);
+          return str;
+       }
+       void appendTo(std::string & out, Layout const & layout) const
+       {
+          if (layout.compact)
+          {
+             // A single ring fills the same under either fill rule
+             int rings = 0;
+             for (auto const& subpath: paths)
+                rings += !subpath.empty();
+             appendCompactPath(out, layout, paths.data(), paths.size(), true, rings > 1);
+             return;
+          }
 
-          ss << "d=\"";
+          out += "\t<path d=\"";
           for (auto const& subpath: paths)
           {
              if (subpath.empty())
                 continue;
 
-             ss << "M";
+             out += 'M';
              for (auto const& point: subpath)
-                ss << translateX(point.x, layout) << "," << translateY(point.y, layout) << " ";
-             ss << "z ";
+             {
+                appendPoint(out, translateX(point.x, layout), translateY(point.y, layout), layout.precision);
+                out += ' ';
+             }
+             out += "z ";
           }
-          ss << "\" ";
-          ss << "fill-rule=\"evenodd\" ";
+          out += "\" fill-rule=\"evenodd\" ";
 
-          ss << fill.toString(layout) << stroke.toString(layout) << emptyElemEnd();
-          return ss.str();
+          fill.appendTo(out, layout);
+          stroke.appendTo(out, layout);
+          out += "/>\n";
        }
 
        void offset(Point const & offset)
@@ -508,6 +862,86 @@ namespace svg
        std::vector<std::vector<Point>> paths;
     };
 
+    // Open outline made of quadratic Bezier pieces, serialized as a single path of Q commands.
+    class QuadraticPath : public Shape
+    {
+    public:
+        QuadraticPath(Fill const & fill = Fill(), Stroke const & stroke = Stroke())
+            : Shape(fill, stroke) { }
+        QuadraticPath(Stroke const & stroke = Stroke()) : Shape(Color::Transparent, stroke) { }
+        // Starts the outline, call before adding any piece.
+        QuadraticPath & moveTo(Point const & point)
+        {
+            points.assign(1, point);
+            return *this;
+        }
+        // Adds a piece from the current end point to end, bent towards control.
+        QuadraticPath & quadTo(Point const & control, Point const & end)
+        {
+            points.push_back(control);
+            points.push_back(end);
+            return *this;
+        }
+        bool empty() const { return points.size() < 3; }
+        std::string toString(Layout const & layout) const
+        {
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        void appendTo(std::string & out, Layout const & layout) const
+        {
+            if (layout.compact)
+            {
+                out += "<path d=\"";
+                RelativeEncoder encoder(out, layout);
+                if (!points.empty())
+                    encoder.moveTo(points[0], true);
+                if (points.size() > 2)
+                    encoder.command('q');
+                for (unsigned i = 1; i + 1 < points.size(); i += 2)
+                {
+                    // Both points of a relative piece are taken from where the piece starts
+                    encoder.offsetTo(points[i]);
+                    encoder.step(points[i + 1]);
+                }
+                out += '"';
+                appendCompactPaint(out, layout);
+                out += "/>\n";
+                return;
+            }
+
+            out += "\t<path d=\"";
+            if (!points.empty())
+            {
+                out += 'M';
+                appendPoint(out, translateX(points[0].x, layout), translateY(points[0].y, layout), layout.precision);
+            }
+            for (unsigned i = 1; i + 1 < points.size(); i += 2)
+            {
+                out += " Q";
+                appendPoint(out, translateX(points[i].x, layout), translateY(points[i].y, layout), layout.precision);
+                out += ' ';
+                appendPoint(out, translateX(points[i + 1].x, layout), translateY(points[i + 1].y, layout), layout.precision);
+            }
+            out += "\" ";
+
+            fill.appendTo(out, layout);
+            stroke.appendTo(out, layout);
+            out += "/>\n";
+        }
+        void offset(Point const & offset)
+        {
+            for (unsigned i = 0; i < points.size(); ++i) {
+                points[i].x += offset.x;
+                points[i].y += offset.y;
+            }
+        }
+    private:
+        // Start point followed by control / end point pairs.
+        std::vector<Point> points;
+    };
+
     class Polyline : public Shape
     {
     public:
@@ -524,16 +958,29 @@ namespace svg
         }
         std::string toString(Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("polyline");
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        void appendTo(std::string & out, Layout const & layout) const
+        {
+            if (layout.compact)
+            {
+                appendCompactPath(out, layout, &points, 1, false, false);
+                return;
+            }
 
-            ss << "points=\"";
+            out += "\t<polyline points=\"";
             for (unsigned i = 0; i < points.size(); ++i)
-                ss << translateX(points[i].x, layout) << "," << translateY(points[i].y, layout) << " ";
-            ss << "\" ";
+            {
+                appendPoint(out, translateX(points[i].x, layout), translateY(points[i].y, layout), layout.precision);
+                out += ' ';
+            }
+            out += "\" ";
 
-            ss << fill.toString(layout) << stroke.toString(layout) << emptyElemEnd();
-            return ss.str();
+            fill.appendTo(out, layout);
+            stroke.appendTo(out, layout);
+            out += "/>\n";
         }
         void offset(Point const & offset)
         {
@@ -553,12 +1000,21 @@ namespace svg
             : Shape(fill, stroke), origin(origin), content(content), font(font) { }
         std::string toString(Layout const & layout) const
         {
-            std::stringstream ss;
-            ss << elemStart("text") << attribute("x", translateX(origin.x, layout))
-                << attribute("y", translateY(origin.y, layout))
-                << fill.toString(layout) << stroke.toString(layout) << font.toString(layout)
-                << ">" << content << elemEnd("text");
-            return ss.str();
+            std::string str;
+            appendTo(str, layout);
+            return str;
+        }
+        void appendTo(std::string & out, Layout const & layout) const
+        {
+            out += elemStart("text");
+            appendAttribute(out, "x", translateX(origin.x, layout), layout.precision);
+            appendAttribute(out, "y", translateY(origin.y, layout), layout.precision);
+            fill.appendTo(out, layout);
+            stroke.appendTo(out, layout);
+            font.appendTo(out, layout);
+            out += ">";
+            out += content;
+            out += elemEnd("text");
         }
         void offset(Point const & offset)
         {
@@ -658,15 +1114,69 @@ namespace svg
         }
     };
 
+    // Either keeps the serialized shapes until save(), or in streaming mode writes the header
+    // right away and every shape into a buffer that is flushed to the file whenever it fills up,
+    // so memory use doesn't grow with the drawing. If the file can't be opened for streaming,
+    // shapes are kept in memory and save() reports the failure. Compressed documents are written
+    // as gzip (.svgz) in either mode, which needs SIMPLE_SVG_ZLIB; without it save() fails.
     class Document
     {
     public:
-        Document(std::string const & file_name, Layout layout = Layout())
-            : file_name(file_name), layout(layout) { }
+        Document(std::string const & file_name, Layout layout = Layout(), bool streaming = false,
+            bool compress = false, size_t buffer_size = 1 << 20)
+            : file_name(file_name), layout(layout), compress(compress), stream_mode(false),
+            finished(false), finish_result(false), file(nullptr),
+#ifdef SIMPLE_SVG_ZLIB
+            gz_file(nullptr),
+#endif
+            buffer_size(buffer_size)
+        {
+            if (!streaming || !openSink())
+                return;
+            stream_mode = true;
+            buffer.reserve(buffer_size + buffer_size / 4);
+            buffer += headerString();
+        }
+        Document(Document const &) = delete;
+        Document & operator=(Document const &) = delete;
+        ~Document()
+        {
+            if (stream_mode)
+                save();
+        }
 
+        bool streaming() const { return stream_mode; }
+        Layout const & getLayout() const { return layout; }
+
+        // Shapes added to a streaming document after save() are dropped, the file is already closed.
         Document & operator<<(Shape const & shape)
         {
-            body_nodes_str_list.push_back(shape.toString(layout));
+            if (finished)
+                return *this;
+            if (!stream_mode)
+            {
+                body_nodes_str_list.push_back(shape.toString(layout));
+                return *this;
+            }
+            shape.appendTo(buffer, layout);
+            if (buffer.size() >= buffer_size)
+                flush();
+            return *this;
+        }
+        // Appends markup formatted elsewhere, like shapes serialized in parallel through appendTo
+        // with this document's layout. Dropped like shapes once a streaming document is saved.
+        Document & appendFragment(std::string const & markup)
+        {
+            if (finished || markup.empty())
+                return *this;
+            if (!stream_mode)
+            {
+                body_nodes_str_list.push_back(markup);
+                return *this;
+            }
+            buffer += markup;
+            if (buffer.size() >= buffer_size)
+                flush();
             return *this;
         }
         std::string toString() const
@@ -675,8 +1185,31 @@ namespace svg
             writeToStream(ss);
             return ss.str();
         }
-        bool save() const
+        // In streaming mode finishes the document and closes the file, nothing can be added after
+        // and later calls return the result of the first one.
+        bool save()
         {
+            if (finished)
+                return finish_result;
+            if (stream_mode)
+            {
+                buffer += elemEnd("svg");
+                bool good = flush();
+                finish_result = closeSink() && good;
+                finished = true;
+                buffer = std::string();
+                return finish_result;
+            }
+
+            if (compress)
+            {
+                if (!openSink())
+                    return false;
+                buffer = toString();
+                bool good = flush();
+                return closeSink() && good;
+            }
+
             std::ofstream ofs(file_name.c_str());
             if (!ofs.good())
                 return false;
@@ -686,26 +1219,101 @@ namespace svg
             return true;
         }
     private:
-        void writeToStream(std::ostream& str) const
+        std::string headerString() const
         {
-            str << "<?xml " << attribute("version", "1.0") << attribute("standalone", "no")
+            if (layout.compact)
+            {
+                std::string str = "<svg xmlns=\"http://www.w3.org/2000/svg\" ";
+                str += attribute("width", layout.dimensions.width);
+                str += attribute("height", layout.dimensions.height);
+                str += "viewBox=\"0 0 ";
+                char buffer[FORMAT_BUFFER_SIZE];
+                str.append(buffer, formatShortest(buffer, translateScale(layout.dimensions.width, layout)));
+                str += ' ';
+                str.append(buffer, formatShortest(buffer, translateScale(layout.dimensions.height, layout)));
+                str += "\">\n";
+                if (layout.palette)
+                    layout.palette->appendStyle(str);
+                return str;
+            }
+
+            std::stringstream ss;
+            ss << "<?xml " << attribute("version", "1.0") << attribute("standalone", "no")
                 << "?>\n<!DOCTYPE svg PUBLIC \"-//W3C//DTD SVG 1.1//EN\" "
                 << "\"http://www.w3.org/Graphics/SVG/1.1/DTD/svg11.dtd\">\n<svg "
                 << attribute("width", layout.dimensions.width, "px")
                 << attribute("height", layout.dimensions.height, "px")
                 << attribute("xmlns", "http://www.w3.org/2000/svg")
                 << attribute("version", "1.1") << ">\n";
+            return ss.str();
+        }
+        void writeToStream(std::ostream& str) const
+        {
+            str << headerString();
             for (const auto& body_node_str : body_nodes_str_list) {
                 str << body_node_str;
             }
             str << elemEnd("svg");
         }
 
+        // The file written by streaming and compressed documents, gzip or plain
+        bool openSink()
+        {
+            if (compress)
+            {
+#ifdef SIMPLE_SVG_ZLIB
+                gz_file = gzopen(file_name.c_str(), "wb9");
+                return gz_file != nullptr;
+#else
+                return false;
+#endif
+            }
+            file = std::fopen(file_name.c_str(), "wb");
+            return file != nullptr;
+        }
+        bool flush()
+        {
+            bool good = true;
+#ifdef SIMPLE_SVG_ZLIB
+            if (gz_file)
+                good = buffer.empty() || gzwrite(gz_file, buffer.data(), (unsigned)buffer.size()) == (int)buffer.size();
+#endif
+            if (file)
+                good = std::fwrite(buffer.data(), 1, buffer.size(), file) == buffer.size();
+            buffer.clear();
+            return good;
+        }
+        bool closeSink()
+        {
+            bool good = true;
+#ifdef SIMPLE_SVG_ZLIB
+            if (gz_file)
+                good = gzclose(gz_file) == Z_OK;
+            gz_file = nullptr;
+#endif
+            if (file)
+                good = std::fclose(file) == 0;
+            file = nullptr;
+            return good;
+        }
+
     private:
         std::string file_name;
         Layout layout;
+        bool compress;
+        bool stream_mode;
+        bool finished;
+        bool finish_result;
 
         std::vector<std::string> body_nodes_str_list;
+
+        // Streaming and compressed output only
+        std::FILE* file;
+#ifdef SIMPLE_SVG_ZLIB
+        gzFile gz_file;
+#endif
+        std::string buffer;
+        size_t buffer_size;
     };
 }
 
@@ -1,5 +1,11 @@
 #include "spline.h"
 #include "voronoi.h"
+#include "parallel.h"
+#include "threadpool.h"
+
+#include <algorithm>
+#include <cmath>
+#include <map>
 
 //Returns the darker pixel by Y luminescence value
 Pixel* darker(Pixel* a, Pixel* b)
@@ -11,97 +17,298 @@ Pixel* darker(Pixel* a, Pixel* b)
 }
 
 //Extracts active edges from voronoi diagrams
-void Spline::extractActiveEdges()
+void Spline::extractActiveEdges(ThreadPool* pool)
 {
 	if(this->diagram == nullptr) return;
-	
-	//For keeping the edges detected till now.
-	std::map<Edge,Pixel*> edgeEnum;
+	activeEdges.clear();
 
 	//Get image dimensions
 	Image* imageRef = this->diagram->getImage(); 
 	int width = imageRef->getWidth();
 	int height = imageRef->getHeight();
 
-	for(int x=0; x <width; x++)
+	//Cells can only share edges with their 4-neighbours and the diagonal neighbours connected in the
+	//planarized graph. Of those, the ones visited before (x,y) in x-major order are the ones on the left
+	//and the one on top. Looking an edge up only in these gives the same edges, in the same order,
+	//as looking it up among all the edges seen so far.
+	const Direction earlier[4] = { TOP_LEFT, LEFT, BOTTOM_LEFT, TOP };
+
+	//Columns are independent, every chunk of columns collects its own edges
+	if(chunkEdges.size() < maxChunks(pool)) chunkEdges.resize(maxChunks(pool));
+	for(auto& found : chunkEdges) found.clear();
+	parallelRanges(pool, 0, width, 16, [&](int chunk, int from, int to)
 	{
-		for(int y=0; y< height; y++)
+		std::vector<std::pair<Edge,Pixel*> >& found = chunkEdges[chunk];
+		for(int x = from; x < to; x++)
 		{
-			for(int i = 0 ; i < (*this->diagram)(x,y).size(); i++) 
+			for(int y = 0; y < height; y++)
 			{
-
-				//Looping over the voronoi hull, of point (x,y), we find the edges which have different colored pixels on either side, and add to active edges.
-				int l = i;
-				int r = (i+1)%((*this->diagram)(x,y).size());
-				if(edgeEnum.find(make_pair((*this->diagram)(x,y)[r],(*this->diagram)(x,y)[l])) != edgeEnum.end()) 
+				Pixel* current = (*imageRef)(x,y);
+				const std::vector<Point>& hull = this->diagram->getHull(x,y);
+				for(int i = 0 ; i < hull.size(); i++)
 				{
-					auto p = edgeEnum[make_pair((*this->diagram)(x,y)[r],(*this->diagram)(x,y)[l])];
-					if(p != (*imageRef)(x,y) && !(p->color() == (*imageRef)(x,y)->color())) activeEdges.push_back(make_pair(make_pair((*this->diagram)(x,y)[l],(*this->diagram)(x,y)[r]),darker(p,(*imageRef)(x,y)))); 
+					//Looping over the voronoi hull, of point (x,y), we find the edges which have different colored pixels on either side, and add to active edges.
+					const Point& l = hull[i];
+					const Point& r = hull[(i+1)%hull.size()];
+					for(Direction dir : earlier)
+					{
+						Pixel* p = imageRef->getAdjacent(x, y, dir);
+						if(!p) continue;
+						const std::vector<Point>& other = this->diagram->getHull(p->X(), p->Y());
+						int j;
+						for(j = 0; j < other.size(); j++)
+							if(other[j] == r && other[(j+1)%other.size()] == l) break;
+						if(j == other.size()) continue;
+						if(!p->color().is_similar(current->color(), similarity)) found.push_back(make_pair(make_pair(l,r),darker(p,current)));
+						break;
+					}
 				}
-				else edgeEnum[std::make_pair((*this->diagram)(x,y)[l],(*this->diagram)(x,y)[r])] = (*imageRef)(x,y);
 			}
 		}
-	}
+	});
+	for(const auto& found : chunkEdges) activeEdges.insert(activeEdges.end(), found.begin(), found.end());
+}
+
+int Spline::vertexIndex(const Point& p) const
+{
+	return std::lower_bound(vertices.begin(), vertices.end(), p) - vertices.begin();
 }
 
 void Spline::calculateGraph()
 {
-	//Convert edge list to adjacency list
-	for(auto edge : activeEdges)
+	//Number the end points of the active edges in Point order
+	arena.reset();
+	vertices.clear();
+	vertices.reserve(2 * activeEdges.size());
+	for(const auto& edge : activeEdges)
+	{
+		vertices.push_back(edge.first.first);
+		vertices.push_back(edge.first.second);
+	}
+	std::sort(vertices.begin(), vertices.end());
+	vertices.erase(std::unique(vertices.begin(), vertices.end()), vertices.end());
+
+	//Convert edge list to adjacency list, every edge is stored in both directions
+	ArenaVector<int> from(2 * activeEdges.size(), &arena);
+	ArenaVector<HalfEdge> half(2 * activeEdges.size(), &arena);
+	adjOffset.assign(vertices.size() + 1, 0);
+	for(int e = 0; e < activeEdges.size(); e++)
+	{
+		int a = vertexIndex(activeEdges[e].first.first);
+		int b = vertexIndex(activeEdges[e].first.second);
+		const Color& c = activeEdges[e].second->color();
+		from[2 * e] = a;
+		half[2 * e] = HalfEdge{ b, c, false };
+		from[2 * e + 1] = b;
+		half[2 * e + 1] = HalfEdge{ a, c, false };
+		adjOffset[a + 1]++;
+		adjOffset[b + 1]++;
+	}
+	for(int v = 0; v < vertices.size(); v++) adjOffset[v + 1] += adjOffset[v];
+
+	//Bucket the half edges by their vertex
+	halfEdges.resize(half.size());
+	ArenaVector<int> fill(adjOffset.begin(), adjOffset.end() - 1, &arena);
+	for(int i = 0; i < half.size(); i++) halfEdges[fill[from[i]]++] = half[i];
+
+	//Sort every neighbour list and drop duplicates, the same way std::set<std::pair<Point,Color>> did
+	auto less = [](const HalfEdge& l, const HalfEdge& r) {
+		return l.to < r.to || (l.to == r.to && l.color < r.color);
+	};
+	int write = 0;
+	for(int v = 0; v < vertices.size(); v++)
+	{
+		auto begin = halfEdges.begin() + adjOffset[v];
+		auto end = halfEdges.begin() + adjOffset[v + 1];
+		std::sort(begin, end, less);
+		adjOffset[v] = write;
+		for(auto it = begin; it != end; it++)
+		{
+			if(it != begin && !less(*(it - 1), *it)) continue;
+			halfEdges[write++] = *it;
+		}
+	}
+	adjOffset[vertices.size()] = write;
+	halfEdges.resize(write);
+	liveStart.assign(adjOffset.begin(), adjOffset.end() - 1);
+}
+
+void Spline::traceFrom(int v, std::vector<std::pair<std::vector<Point>,Color> >& curves, int& count)
+{
+	while(true)
 	{
-		graph[edge.first.first].insert(std::make_pair(edge.first.second,edge.second->color()));
-		graph[edge.first.second].insert(std::make_pair(edge.first.first,edge.second->color()));
+		int& first = liveStart[v];
+		while(first < adjOffset[v + 1] && halfEdges[first].used) first++;
+		if(first == adjOffset[v + 1]) break;
+		int src = halfEdges[first].to;
+		Color c = halfEdges[first].color;
+		if(count == curves.size()) curves.emplace_back();
+		traverse(src, c, curves[count].first);
+		curves[count++].second = c;
 	}
 }
 
-std::vector<std::pair<std::vector<Point>,Color> > Spline::printGraph()
+std::vector<std::pair<std::vector<Point>,Color> > Spline::printGraph(ThreadPool* pool)
+{
+	std::vector<std::pair<std::vector<Point>, Color> > curves;
+	printGraph(curves, pool);
+	return curves;
+}
+
+void Spline::printGraph(std::vector<std::pair<std::vector<Point>,Color> >& mainOutLine, ThreadPool* pool)
 {
 	//Tracing curves. Starting with a random node, We trace out a curve with same colors
-	std::vector<std::pair<std::vector<Point>, Color> > mainOutLine;
-	std::map<Point, std::set<std::pair<Point,Color> > >::iterator vertexPt = graph.begin();
-	while(vertexPt != graph.end())
+	int n = vertices.size();
+
+	if(!pool || pool->size() < 2)
 	{
-		while((vertexPt->second).size() > 0)
+		//Spare curves are put at the end to be traced into, the ones not needed go back afterwards
+		int count = 0;
+		resizeReusing(mainOutLine, mainOutLine.size() + spareCurves.size(), spareCurves);
+		for(int v = 0; v < n; v++) traceFrom(v, mainOutLine, count);
+		resizeReusing(mainOutLine, count, spareCurves);
+		return;
+	}
+
+	//A traversal never leaves the connected component of its start, so components can be traced
+	//independently. Find them with union find over the half edges. Scratch of this thread comes
+	//from the arena, the tasks allocate from the heap.
+	arena.reset();
+	ArenaVector<int> parent(n, &arena);
+	for(int v = 0; v < n; v++) parent[v] = v;
+	auto findRoot = [&parent](int v) {
+		while(parent[v] != v)
+		{
+			parent[v] = parent[parent[v]];
+			v = parent[v];
+		}
+		return v;
+	};
+	for(int v = 0; v < n; v++)
+		for(int it = adjOffset[v]; it < adjOffset[v + 1]; it++)
 		{
-			Point src = (vertexPt->second).begin()->first;
-			Color c = (vertexPt->second).begin()->second;
-			std::vector<Point> v = traverseGraph(src, c);
-			mainOutLine.push_back(std::make_pair(v,c));
+			int a = findRoot(v);
+			int b = findRoot(halfEdges[it].to);
+			if(a != b) parent[std::max(a, b)] = std::min(a, b);
 		}
-		vertexPt ++;
+
+	//Vertices of every component in ascending order, components numbered by their smallest vertex.
+	//Isolated vertices have nothing to trace and are left out.
+	ArenaVector<int> component(n, -1, &arena);
+	ArenaVector<int> compOffset(1, 0, &arena);
+	ArenaVector<int> compEdges(&arena);
+	for(int v = 0; v < n; v++)
+	{
+		if(adjOffset[v] == adjOffset[v + 1]) continue;
+		int root = findRoot(v);
+		if(component[root] < 0)
+		{
+			component[root] = compEdges.size();
+			compOffset.push_back(0);
+			compEdges.push_back(0);
+		}
+		component[v] = component[root];
+		compOffset[component[v] + 1]++;
+		compEdges[component[v]] += adjOffset[v + 1] - adjOffset[v];
 	}
-	return mainOutLine;
+	int components = compEdges.size();
+	for(int c = 0; c < components; c++) compOffset[c + 1] += compOffset[c];
+	ArenaVector<int> compVertices(compOffset.back(), &arena);
+	ArenaVector<int> fill(compOffset.begin(), compOffset.end() - 1, &arena);
+	for(int v = 0; v < n; v++)
+		if(component[v] >= 0) compVertices[fill[component[v]]++] = v;
+
+	//Pack consecutive components into tasks of about TRACE_GRAIN half edges, big components get a task each
+	ArenaVector<int> taskBegin(1, 0, &arena);
+	for(int c = 0, edges = 0; c < components; c++)
+	{
+		edges += compEdges[c];
+		if(edges >= TRACE_GRAIN || c + 1 == components)
+		{
+			taskBegin.push_back(c + 1);
+			edges = 0;
+		}
+	}
+	int tasks = taskBegin.size() - 1;
+
+	//Every task visits its vertices in ascending order like the serial loop and, since the other
+	//components don't share any edges with it, traces exactly the curves the serial loop would
+	if(taskCurves.size() < tasks)
+	{
+		taskCurves.resize(tasks);
+		taskStarts.resize(tasks);
+	}
+	ArenaVector<int> taskCount(tasks, 0, &arena);
+	TaskGroup group;
+	for(int t = 0; t < tasks; t++)
+		pool->submit([&, t]() {
+			taskStarts[t].clear();
+			for(int i = compOffset[taskBegin[t]]; i < compOffset[taskBegin[t + 1]]; i++)
+			{
+				int v = compVertices[i];
+				traceFrom(v, taskCurves[t], taskCount[t]);
+				taskStarts[t].resize(taskCount[t], v);
+			}
+		}, group);
+	pool->wait(group);
+
+	//Merge in the serial order: by start vertex, then by order of tracing
+	ArenaVector<int> startOffset(n + 1, 0, &arena);
+	for(int t = 0; t < tasks; t++)
+		for(int v : taskStarts[t]) startOffset[v + 1]++;
+	for(int v = 0; v < n; v++) startOffset[v + 1] += startOffset[v];
+	//Swapping leaves the buffers of the previous curves with the tasks for the next run
+	resizeReusing(mainOutLine, startOffset[n], spareCurves);
+	for(int t = 0; t < tasks; t++)
+		for(int i = 0; i < taskCount[t]; i++)
+		{
+			auto& curve = mainOutLine[startOffset[taskStarts[t][i]]++];
+			curve.first.swap(taskCurves[t][i].first);
+			curve.second = taskCurves[t][i].second;
+		}
 }
 
 std::vector<Point > Spline::traverseGraph(const Point& p, const Color& c)
 {
-	//Contains nodes that have been visited
+	int v = vertexIndex(p);
+	if(v == vertices.size() || vertices[v] != p) return std::vector<Point>{p, p};
+	return traverseGraph(v, c);
+}
+
+std::vector<Point > Spline::traverseGraph(int start, const Color& c)
+{
 	std::vector<Point> points;
-	Point x = p;
-	Point prev = Point(-1,-1);
+	traverse(start, c, points);
+	return points;
+}
+
+void Spline::traverse(int start, const Color& c, std::vector<Point>& points)
+{
+	//Contains nodes that have been visited
+	points.clear();
+	int x = start;
 	Color curr = c;
 	bool found = true;
 	while(true)
 	{
-		points.push_back(x);
-		for(auto it = graph[x].begin(); it != graph[x].end(); it++) 
+		points.push_back(vertices[x]);
+		for(int it = liveStart[x]; it < adjOffset[x + 1]; it++)
 		{
-			if(it->first == prev) continue;
+			//The edge we came along is already used, so it can't lead back
+			if(halfEdges[it].used) continue;
 			//If color of a node is similar to that of one vertex in the adj list, then connect that node.
-			if(it->second == c) {
-				Point p2 = it->first;
-				//cerr << x << "->" << graph[x] << " " << it->first<< "->" << " " << graph[it->first] << endl;
-				std::set<std::pair<Point,Color> >::iterator it1;
-				for(it1 = graph[p2].begin(); it1 != graph[p2].end(); it1++) {
-					if(curr == it1->second && it1->first == x) break;
+			if(halfEdges[it].color == c) {
+				int p2 = halfEdges[it].to;
+				int it1;
+				for(it1 = liveStart[p2]; it1 < adjOffset[p2 + 1]; it1++) {
+					if(halfEdges[it1].used) continue;
+					if(curr == halfEdges[it1].color && halfEdges[it1].to == x) break;
 				}
-				
-				if(it1 == graph[p2].end()) break;
-				curr = it->second;
-				graph[x].erase(it);
-				graph[p2].erase(it1);
-				//cerr << x << "->" << graph[x] << " " << p2<< "->" << " " << graph[p2] << endl;
-				//cerr << "======\n";
+
+				if(it1 == adjOffset[p2 + 1]) break;
+				curr = halfEdges[it].color;
+				halfEdges[it].used = true;
+				halfEdges[it1].used = true;
 				x = p2;
 				found = true;
 				break;
@@ -114,30 +321,237 @@ std::vector<Point > Spline::traverseGraph(const Point& p, const Color& c)
 	{
 		points.push_back(points[1]);
 	}
-	return points;
 }
 
-//REF: http://math.stackexchange.com/questions/115241/manually-deducing-the-quadratic-uniform-b-spline-basis-functions
-std::vector<std::vector<float> > Spline::getSpline(std::vector<Point > points) // For 3 points
+int Spline::optimizeCurves(std::vector<std::pair<std::vector<Point>,Color> >& curves, const OptimizeOptions& options, Arena* scratch,
+	ThreadPool* pool)
 {
-	//assert(points.size() == 3);
-	//Basis Matrix for quadratic uniform b-spline
-	float B[3][3] = {{1, 1, 0},{ -2, 2, 0},{1, -2, 1}};
+	if(options.iterations <= 0 || curves.empty()) return 0;
+	if(scratch) scratch->reset();
 
-	// 3x2 vector matrix initialized with 0
-	std::vector<std::vector<float> > a(3,std::vector<float>(2,0));
+	//Closed curves come back from traverseGraph with their first two points repeated at the end
+	auto isClosed = [](const std::vector<Point>& points) {
+		int n = points.size();
+		return n >= 4 && points[0] == points[n-2] && points[1] == points[n-1];
+	};
 
-	// multiply it with B-splines basis matrix
+	//Control points of all curves in flat arrays, curve c owns [offset[c], offset[c+1]).
+	//Closed curves store every point once.
+	ArenaVector<int> offset(curves.size() + 1, 0, scratch);
+	ArenaVector<char> closed(curves.size(), scratch);
+	for(int c = 0; c < curves.size(); c++)
+	{
+		closed[c] = isClosed(curves[c].first);
+		offset[c + 1] = offset[c] + curves[c].first.size() - (closed[c] ? 2 : 0);
+	}
+	const int total = offset.back();
+	ArenaVector<float> ox(total, scratch), oy(total, scratch), xs(total, scratch), ys(total, scratch), nx(total, scratch), ny(total, scratch);
+	for(int c = 0; c < curves.size(); c++)
+		for(int i = offset[c]; i < offset[c + 1]; i++)
+		{
+			ox[i] = xs[i] = curves[c].first[i - offset[c]].first;
+			oy[i] = ys[i] = curves[c].first[i - offset[c]].second;
+		}
+
+	//Points on more than one curve are junctions and stay pinned, as do the end points of open curves
+	std::map<Point,int,std::less<Point>,ArenaAllocator<std::pair<const Point,int> > > uses(scratch);
+	ArenaVector<Point> own(scratch);
+	for(int c = 0; c < curves.size(); c++)
+	{
+		own.assign(curves[c].first.begin(), curves[c].first.end());
+		std::sort(own.begin(), own.end());
+		own.erase(std::unique(own.begin(), own.end()), own.end());
+		for(const Point& p : own) uses[p]++;
+	}
+
+	//Minimizing w_s |p - mid|^2 + w_p |p - o|^2 for one point gives p = ks * (left + right) + kp * o
+	ArenaVector<float> ks(total, scratch), kp(total, scratch);
+	const float ws = std::max(options.smoothness, 0.0f);
+	const float wp = std::max(options.positional, 1e-6f);
+	for(int c = 0; c < curves.size(); c++)
+		for(int i = offset[c]; i < offset[c + 1]; i++)
+		{
+			bool pinned = uses[Point(ox[i], oy[i])] > 1 ||
+				(!closed[c] && (i == offset[c] || i == offset[c + 1] - 1));
+			ks[i] = pinned ? 0.0f : 0.5f * ws / (ws + wp);
+			kp[i] = pinned ? 1.0f : wp / (ws + wp);
+		}
+
+	//Curves are independent, relax them in chunks on pool with Jacobi sweeps until they settle
+	ArenaVector<int> chunkSweeps(maxChunks(pool), 0, scratch);
+	parallelRanges(pool, 0, curves.size(), 64, [&](int chunk, int from, int to)
+	{
+		for(int c = from; c < to; c++)
+		{
+			const int b = offset[c], e = offset[c + 1];
+			if(e - b < 3) continue;
+			int sweep;
+			for(sweep = 1; sweep <= options.iterations; sweep++)
+			{
+				float* __restrict px = nx.data();
+				float* __restrict py = ny.data();
+				const float* __restrict cx = xs.data();
+				const float* __restrict cy = ys.data();
+				for(int i = b + 1; i < e - 1; i++)
+				{
+					px[i] = ks[i] * (cx[i-1] + cx[i+1]) + kp[i] * ox[i];
+					py[i] = ks[i] * (cy[i-1] + cy[i+1]) + kp[i] * oy[i];
+				}
+				//The ends wrap around on closed curves, open curves have their ends pinned
+				int prevB = closed[c] ? e - 1 : b, nextE = closed[c] ? b : e - 1;
+				px[b] = ks[b] * (cx[prevB] + cx[b+1]) + kp[b] * ox[b];
+				py[b] = ks[b] * (cy[prevB] + cy[b+1]) + kp[b] * oy[b];
+				px[e-1] = ks[e-1] * (cx[e-2] + cx[nextE]) + kp[e-1] * ox[e-1];
+				py[e-1] = ks[e-1] * (cy[e-2] + cy[nextE]) + kp[e-1] * oy[e-1];
+
+				float moved = 0;
+				for(int i = b; i < e; i++) moved = std::max(moved, std::max(std::abs(px[i] - cx[i]), std::abs(py[i] - cy[i])));
+				std::copy(px + b, px + e, xs.begin() + b);
+				std::copy(py + b, py + e, ys.begin() + b);
+				if(moved < options.tolerance) break;
+			}
+			chunkSweeps[chunk] = std::max(chunkSweeps[chunk], std::min(sweep, options.iterations));
+		}
+	});
+
+	//Write the relaxed points back, repeating the wrap around points of closed curves
+	for(int c = 0; c < curves.size(); c++)
+	{
+		std::vector<Point>& points = curves[c].first;
+		for(int i = offset[c]; i < offset[c + 1]; i++) points[i - offset[c]] = Point(xs[i], ys[i]);
+		if(closed[c])
+		{
+			int n = points.size();
+			points[n-2] = points[0];
+			points[n-1] = points[1];
+		}
+	}
+	return *std::max_element(chunkSweeps.begin(), chunkSweeps.end());
+}
+
+void Spline::getSpline(const Point& p1, const Point& p2, const Point& p3, float a[3][2]) // For 3 points
+{
+	// multiply the control points with the B-splines basis matrix
 	for(int i = 0 ; i < 3; i++)
 	{
-		for(int j = 0; j < 2; j++)
+		a[i][0] = BSPLINE_BASIS[i][0]*p1.first + BSPLINE_BASIS[i][1]*p2.first + BSPLINE_BASIS[i][2]*p3.first;
+		a[i][1] = BSPLINE_BASIS[i][0]*p1.second + BSPLINE_BASIS[i][1]*p2.second + BSPLINE_BASIS[i][2]*p3.second;
+	}
+}
+
+void SplineBatch::build(const std::vector<std::pair<std::vector<Point>,Color> >& curves)
+{
+	x0.clear(); y0.clear(); x1.clear(); y1.clear(); x2.clear(); y2.clear();
+	curveOffset.assign(1, 0);
+	colors.clear();
+	for(const auto& curve : curves)
+	{
+		const std::vector<Point>& points = curve.first;
+		for(int i = 0; i + 2 < points.size(); i++)
 		{
-			for(int k = 0 ; k < 3; k ++) 
+			x0.push_back(points[i].first);
+			y0.push_back(points[i].second);
+			x1.push_back(points[i+1].first);
+			y1.push_back(points[i+1].second);
+			x2.push_back(points[i+2].first);
+			y2.push_back(points[i+2].second);
+		}
+		curveOffset.push_back(x0.size());
+		colors.push_back(curve.second);
+	}
+}
+
+//Evaluates segments [0, segments) of the given control point arrays at ts[0..count), sample major
+static void evaluateSegments(const float* __restrict px0, const float* __restrict py0,
+	const float* __restrict px1, const float* __restrict py1,
+	const float* __restrict px2, const float* __restrict py2, int segments,
+	const float* ts, int count, float* outX, float* outY)
+{
+	for(int k = 0; k < count; k++)
+	{
+		//Weight of every control point at ts[k], [1 t t^2] * BSPLINE_BASIS
+		const float t = ts[k];
+		float w[3];
+		for(int j = 0; j < 3; j++) w[j] = BSPLINE_BASIS[0][j] + BSPLINE_BASIS[1][j]*t + BSPLINE_BASIS[2][j]*t*t;
+
+		float* __restrict ox = outX + (size_t)k * segments;
+		float* __restrict oy = outY + (size_t)k * segments;
+		for(int s = 0; s < segments; s++)
+		{
+			ox[s] = w[0]*px0[s] + w[1]*px1[s] + w[2]*px2[s];
+			oy[s] = w[0]*py0[s] + w[1]*py1[s] + w[2]*py2[s];
+		}
+	}
+}
+
+void SplineBatch::evaluate(const float* ts, int count, float* outX, float* outY) const
+{
+	evaluateSegments(x0.data(), y0.data(), x1.data(), y1.data(), x2.data(), y2.data(), x0.size(),
+		ts, count, outX, outY);
+}
+
+void SplineBatch::tessellate(float tolerance, float scale, float t0, float t1,
+	std::vector<float>& outX, std::vector<float>& outY, std::vector<int>& offsets) const
+{
+	//Upper bound on the steps per segment, as dense as the old fixed 0.01 sampling
+	const int MAX_STEPS = 120;
+	const int segments = x0.size();
+	tolerance = std::max(tolerance, 1e-6f);
+
+	//A quadratic has the constant second derivative 2*a2, so a chord spanning h in t strays at most
+	//|a2| h^2 / 4 from the curve. That gives the step count needed for the tolerance in closed form.
+	offsets.resize(segments + 1);
+	offsets[0] = 0;
+	for(int s = 0; s < segments; s++)
+	{
+		float ax = BSPLINE_BASIS[2][0]*x0[s] + BSPLINE_BASIS[2][1]*x1[s] + BSPLINE_BASIS[2][2]*x2[s];
+		float ay = BSPLINE_BASIS[2][0]*y0[s] + BSPLINE_BASIS[2][1]*y1[s] + BSPLINE_BASIS[2][2]*y2[s];
+		float bend = std::sqrt(ax*ax + ay*ay) * scale;
+		int steps = (int)std::ceil((t1 - t0) * std::sqrt(bend / (4 * tolerance)));
+		steps = std::min(std::max(steps, 1), MAX_STEPS);
+		offsets[s + 1] = offsets[s] + steps + 1;
+	}
+
+	outX.resize(offsets[segments]);
+	outY.resize(offsets[segments]);
+
+	//Segments sharing a step count share their parameters, so every such bucket is gathered and
+	//evaluated in one batch, then the samples are scattered to their segments
+	std::vector<int> bucketOffset(MAX_STEPS + 2, 0);
+	for(int s = 0; s < segments; s++) bucketOffset[offsets[s + 1] - offsets[s]]++;
+	for(int n = 0; n <= MAX_STEPS; n++) bucketOffset[n + 1] += bucketOffset[n];
+	std::vector<int> order(segments);
+	std::vector<int> fill(bucketOffset.begin(), bucketOffset.end() - 1);
+	for(int s = 0; s < segments; s++) order[fill[offsets[s + 1] - offsets[s] - 1]++] = s;
+
+	std::vector<float> bx0, by0, bx1, by1, bx2, by2, ts, sx, sy;
+	for(int steps = 1; steps <= MAX_STEPS; steps++)
+	{
+		int begin = bucketOffset[steps];
+		int n = bucketOffset[steps + 1] - begin;
+		if(n == 0) continue;
+		bx0.resize(n); by0.resize(n); bx1.resize(n); by1.resize(n); bx2.resize(n); by2.resize(n);
+		for(int i = 0; i < n; i++)
+		{
+			int s = order[begin + i];
+			bx0[i] = x0[s]; by0[i] = y0[s];
+			bx1[i] = x1[s]; by1[i] = y1[s];
+			bx2[i] = x2[s]; by2[i] = y2[s];
+		}
+		ts.resize(steps + 1);
+		for(int k = 0; k <= steps; k++) ts[k] = t0 + (t1 - t0) * k / steps;
+		sx.resize((size_t)n * (steps + 1));
+		sy.resize((size_t)n * (steps + 1));
+		evaluateSegments(bx0.data(), by0.data(), bx1.data(), by1.data(), bx2.data(), by2.data(), n,
+			ts.data(), steps + 1, sx.data(), sy.data());
+		for(int i = 0; i < n; i++)
+		{
+			int s = order[begin + i];
+			for(int k = 0; k <= steps; k++)
 			{
-				if(j == 0) a[i][j] += 0.5*B[i][k]*points[k].first;
-				else a[i][j] += 0.5*B[i][k]*points[k].second;
+				outX[offsets[s] + k] = sx[(size_t)k * n + i];
+				outY[offsets[s] + k] = sy[(size_t)k * n + i];
 			}
 		}
 	}
-	return a;
-}
\ No newline at end of file
+}
@@ -5,47 +5,168 @@
 
 #include "voronoi.h"
 
+class ThreadPool;
+
 #include <vector>
 #include <utility>
-#include <set>
-#include <map>
 
 //Class Spline: For handling path detection for drawing continuous curves and bspline generation
 
+//Settings of the spline optimization stage
+struct OptimizeOptions
+{
+	//Maximum relaxation sweeps per curve, 0 turns the stage off
+	int iterations = 16;
+	//A curve is done once no control point moves further than this (in pixels) in a sweep
+	float tolerance = 1e-3f;
+	//Weights of the smoothness term (distance to the midpoint of the neighbours)
+	//and of the positional term (distance to the traced position)
+	float smoothness = 1.0f;
+	float positional = 1.0f;
+	bool operator==(const OptimizeOptions& o) const
+	{
+		return iterations == o.iterations && tolerance == o.tolerance && smoothness == o.smoothness && positional == o.positional;
+	}
+	bool operator!=(const OptimizeOptions& o) const {return !(*this == o);}
+};
+
+//Basis matrix of the quadratic uniform B-spline, with its 1/2 factor folded in.
+//Row i holds the weights of the control points in the coefficient of t^i.
+//REF: http://math.stackexchange.com/questions/115241/manually-deducing-the-quadratic-uniform-b-spline-basis-functions
+constexpr float BSPLINE_BASIS[3][3] = {{0.5f, 0.5f, 0.0f}, {-1.0f, 1.0f, 0.0f}, {0.5f, -1.0f, 0.5f}};
+
 class Spline
 {
 	//Reference to Voronoi diagram
 	Voronoi* diagram;
 
+	//Edges between cells with colors similar by these are not active
+	SimilarityThresholds similarity;
+
 	//List of all edges that have sufficiently different colors at the 2 sides
 	std::vector<std::pair<Edge,Pixel*> > activeEdges;
 
-	//Contains a adjacency list representation for the above
-	std::map<Point, std::set<std::pair<Point,Color> > > graph;
+	//Active edges found by every chunk of columns, kept for their buffers
+	std::vector<std::vector<std::pair<Edge,Pixel*> > > chunkEdges;
+
+	//One direction of an active edge, as seen from the vertex it leaves
+	struct HalfEdge
+	{
+		int to;
+		Color color;
+		bool used;
+	};
+
+	//Adjacency list representation for the above, indexed by vertex. Vertices are numbered in Point order,
+	//the half edges of vertex v are halfEdges[adjOffset[v]..adjOffset[v+1]), sorted by (to, color).
+	//Traced edges are marked used instead of being erased.
+	std::vector<Point> vertices;
+	std::vector<int> adjOffset;
+	std::vector<HalfEdge> halfEdges;
+
+	//First half edge of every vertex that may still be unused
+	std::vector<int> liveStart;
+
+	//Scratch memory of calculateGraph and printGraph
+	Arena arena;
+
+	//Index of the vertex at point p
+	int vertexIndex(const Point& p) const;
+
+	//Traces curves starting from vertex v until all its half edges are used. They are written to
+	//curves[count..], overwriting the curves there to reuse their buffers, and count is advanced.
+	void traceFrom(int v, std::vector<std::pair<std::vector<Point>,Color> >& curves, int& count);
+
+	//Traversal of traverseGraph, into points
+	void traverse(int start, const Color& c, std::vector<Point>& points);
+
+	//Curves traced by every parallel task and their start vertices, kept for their buffers
+	std::vector<std::vector<std::pair<std::vector<Point>,Color> > > taskCurves;
+	std::vector<std::vector<int> > taskStarts;
+
+	//Curves left over from tracing larger images, see resizeReusing. Only the calling thread uses them.
+	std::vector<std::pair<std::vector<Point>,Color> > spareCurves;
+
+	//Half edges per tracing task, smaller components are packed together up to this size
+	static const int TRACE_GRAIN = 4096;
 	public:
 		//Parametric Constructor
-		Spline(Voronoi* d) : diagram(d) {};
+		Spline(Voronoi* d, const SimilarityThresholds& s = SimilarityThresholds()) : diagram(d), similarity(s) {};
 
 		//Default Constructor
 		Spline() : diagram(nullptr) {};
+
+		Spline(const Spline&) = delete;
+		Spline& operator=(const Spline&) = delete;
+
+		//Changes which edges extractActiveEdges picks up
+		void setSimilarity(const SimilarityThresholds& s) {similarity = s;}
 		
 		//Accessor
 		std::vector<std::pair<Edge,Pixel*> >& getActiveEdges() {return activeEdges;}
 		
-		//Extract active edges from the diagram
-		void extractActiveEdges();
+		//Extract active edges from the diagram, in chunks of columns on pool if given
+		void extractActiveEdges(ThreadPool* pool = nullptr);
 
 		//Create Adjacency list from Active Edges
 		void calculateGraph();
 
 		//Traverse a continuous curve starting from p and following color similar to c
 		std::vector<Point> traverseGraph(const Point& p, const Color& c);
+		std::vector<Point> traverseGraph(int v, const Color& c);
 
-		//Get quadratic uniform B-spline for 3 points
-		std::vector<std::vector<float> > getSpline(std::vector<Point> points);
+		//Get quadratic uniform B-spline for 3 points, x(t) = a[0][0] + a[1][0] t + a[2][0] t^2 and likewise for y
+		static void getSpline(const Point& p1, const Point& p2, const Point& p3, float a[3][2]);
 		
-		//Get the traced paths for drawing splines
-		std::vector<std::pair<std::vector<Point>,Color> > printGraph();
+		//Get the traced paths for drawing splines. Connected components of the graph are traced in
+		//parallel on pool if given, serially otherwise. The curves come out in the same order either way.
+		std::vector<std::pair<std::vector<Point>,Color> > printGraph(ThreadPool* pool = nullptr);
+
+		//Same as above, tracing into curves. The curves already in there are overwritten, so tracing
+		//a similar image again reuses their buffers.
+		void printGraph(std::vector<std::pair<std::vector<Point>,Color> >& curves, ThreadPool* pool = nullptr);
+
+		//Optimize B-Splines: moves the control points of the traced curves to minimize smoothness plus
+		//positional energy. Points shared by several curves stay put so that curves keep meeting.
+		//Returns the largest number of sweeps any curve needed. Scratch buffers come from scratch if given,
+		//which is reset first. Chunks of curves are relaxed on pool if given.
+		static int optimizeCurves(std::vector<std::pair<std::vector<Point>,Color> >& curves, const OptimizeOptions& options = OptimizeOptions(),
+			Arena* scratch = nullptr, ThreadPool* pool = nullptr);
+};
+
+//Class SplineBatch: Evaluates the segments of many curves at once.
+//Every window of 3 consecutive curve points is one segment. The control points of all segments are
+//kept in structure of arrays form, so evaluation runs over all segments in one vectorizable loop.
+
+class SplineBatch
+{
+	//Control points of segment s are (x0[s],y0[s]), (x1[s],y1[s]) and (x2[s],y2[s])
+	std::vector<float> x0, y0, x1, y1, x2, y2;
+
+	//Segments of curve c are [curveOffset[c], curveOffset[c+1])
+	std::vector<int> curveOffset;
+	std::vector<Color> colors;
+	public:
+		//Collects the segments of the traced curves
+		void build(const std::vector<std::pair<std::vector<Point>,Color> >& curves);
+
+		//Evaluates every segment at the parameters ts[0..count). The point of segment s at ts[k] is written
+		//to outX[k * segments + s], outY[k * segments + s], the buffers must hold count * segments floats.
+		void evaluate(const float* ts, int count, float* outX, float* outY) const;
+
+		//Flattens every segment over t in [t0, t1] into as few uniform steps as keep the polyline within
+		//tolerance of the curve, measured after scaling the coordinates by scale. Nearly straight segments
+		//collapse to their two end points. The points of segment s are written to
+		//outX/outY[offsets[s]..offsets[s+1]), the vectors are resized as needed.
+		void tessellate(float tolerance, float scale, float t0, float t1,
+			std::vector<float>& outX, std::vector<float>& outY, std::vector<int>& offsets) const;
+
+		//Accessors
+		int getSegmentCount() const {return x0.size();}
+		int getCurveCount() const {return colors.size();}
+		int getCurveBegin(int c) const {return curveOffset[c];}
+		int getCurveEnd(int c) const {return curveOffset[c + 1];}
+		const Color& getColor(int c) const {return colors[c];}
 };
 
 #endif
@@ -0,0 +1,181 @@
+#include "stats.h"
+#include "writer.h"
+
+#ifdef _WIN32
+#define NOMINMAX
+#include <windows.h>
+#include <psapi.h>
+#else
+#include <sys/resource.h>
+#endif
+
+double processCpuSeconds()
+{
+#ifdef _WIN32
+	FILETIME created, exited, kernel, user;
+	if(!GetProcessTimes(GetCurrentProcess(), &created, &exited, &kernel, &user)) return 0;
+	auto ticks = [](const FILETIME& t) { return ((unsigned long long)t.dwHighDateTime << 32) | t.dwLowDateTime; };
+	//FILETIME counts 100 ns ticks
+	return (ticks(kernel) + ticks(user)) * 1e-7;
+#else
+	rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+	return usage.ru_utime.tv_sec + usage.ru_stime.tv_sec + (usage.ru_utime.tv_usec + usage.ru_stime.tv_usec) * 1e-6;
+#endif
+}
+
+long long peakResidentBytes()
+{
+#ifdef _WIN32
+	PROCESS_MEMORY_COUNTERS counters;
+	if(!GetProcessMemoryInfo(GetCurrentProcess(), &counters, sizeof(counters))) return 0;
+	return counters.PeakWorkingSetSize;
+#else
+	rusage usage;
+	if(getrusage(RUSAGE_SELF, &usage) != 0) return 0;
+#ifdef __APPLE__
+	return usage.ru_maxrss;
+#else
+	//Kilobytes everywhere else
+	return usage.ru_maxrss * 1024LL;
+#endif
+#endif
+}
+
+void StageTimes::skip()
+{
+	last = std::chrono::steady_clock::now();
+	lastCpu = processCpuSeconds();
+	lastPeak = peakResidentBytes();
+	lastAllocations = heapAllocations();
+}
+
+void StageTimes::lap(const std::string& name)
+{
+	StageSample stage;
+	stage.name = name;
+	auto now = std::chrono::steady_clock::now();
+	stage.wall = std::chrono::duration<double>(now - last).count();
+	double cpu = processCpuSeconds();
+	stage.cpu = cpu - lastCpu;
+	long long peak = peakResidentBytes();
+	stage.peakRss = peak - lastPeak;
+	long long allocations = heapAllocations();
+	if(allocations >= 0) stage.allocations = allocations - lastAllocations;
+	stages.push_back(stage);
+
+	last = now;
+	lastCpu = cpu;
+	lastPeak = peak;
+	lastAllocations = allocations;
+}
+
+void StageTimes::append(const StageTimes& other)
+{
+	stages.insert(stages.end(), other.stages.begin(), other.stages.end());
+	skip();
+}
+
+//Writes s as a JSON string
+static void writeJsonString(BufferedWriter& out, const std::string& s)
+{
+	out << '"';
+	for(char c : s)
+	{
+		if(c == '"' || c == '\\') out << '\\';
+		out << c;
+	}
+	out << '"';
+}
+
+bool writeStatsJson(const std::string& path, const StageTimes& times, const StatCounts& counts)
+{
+	BufferedWriter out(path);
+	if(!out.good()) return false;
+	//Microseconds are plenty for stage times
+	out.setPrecision(6);
+
+	out << "{\"stages\":[";
+	const auto& stages = times.getStages();
+	for(int i = 0; i < stages.size(); i++)
+	{
+		const StageSample& stage = stages[i];
+		out << (i ? ",\n" : "\n") << "{\"name\":";
+		writeJsonString(out, stage.name);
+		out << ",\"wallSeconds\":" << stage.wall << ",\"cpuSeconds\":" << stage.cpu << ",\"peakRssDeltaBytes\":";
+		out.writeInt(stage.peakRss);
+		if(stage.allocations >= 0)
+		{
+			out << ",\"heapAllocations\":";
+			out.writeInt(stage.allocations);
+		}
+		out << '}';
+	}
+	out << "],\n\"totalWallSeconds\":" << times.total() << ",\n\"counts\":{";
+	for(int i = 0; i < counts.size(); i++)
+	{
+		if(i) out << ',';
+		writeJsonString(out, counts[i].first);
+		out << ':';
+		out.writeInt(counts[i].second);
+	}
+	out << "}}\n";
+	return out.close();
+}
+
+#ifdef COUNT_ALLOCATIONS
+
+#include <atomic>
+#include <cstdlib>
+#include <new>
+
+static std::atomic<long long> allocations(0);
+
+void* operator new(std::size_t size)
+{
+	allocations.fetch_add(1, std::memory_order_relaxed);
+	while(true)
+	{
+		if(void* p = std::malloc(size ? size : 1)) return p;
+		std::new_handler handler = std::get_new_handler();
+		if(!handler) throw std::bad_alloc();
+		handler();
+	}
+}
+
+void* operator new[](std::size_t size) {return operator new(size);}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+	try
+	{
+		return operator new(size);
+	}
+	catch(...)
+	{
+		return nullptr;
+	}
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t& tag) noexcept {return operator new(size, tag);}
+
+void operator delete(void* p) noexcept {std::free(p);}
+void operator delete[](void* p) noexcept {std::free(p);}
+void operator delete(void* p, std::size_t) noexcept {std::free(p);}
+void operator delete[](void* p, std::size_t) noexcept {std::free(p);}
+void operator delete(void* p, const std::nothrow_t&) noexcept {std::free(p);}
+void operator delete[](void* p, const std::nothrow_t&) noexcept {std::free(p);}
+
+long long heapAllocations()
+{
+	return allocations.load(std::memory_order_relaxed);
+}
+
+#else
+
+long long heapAllocations()
+{
+	return -1;
+}
+
+#endif
@@ -0,0 +1,90 @@
+#pragma once
+
+#ifndef _STATS_H
+#define _STATS_H
+
+#include <chrono>
+#include <string>
+#include <utility>
+#include <vector>
+
+//Process wide resource counters, sampled around every stage by StageTimes
+
+//CPU time the process spent so far in all of its threads, user and system, in seconds
+double processCpuSeconds();
+
+//Largest resident set size the process reached so far in bytes, 0 where the platform doesn't tell
+long long peakResidentBytes();
+
+//Number of global heap allocations since the program started, counting operator new of any thread.
+//Only counted when built with COUNT_ALLOCATIONS, -1 otherwise.
+long long heapAllocations();
+
+//Cost of one stage
+struct StageSample
+{
+	std::string name;
+	//Seconds of wall clock and of process CPU time, the latter includes helper threads
+	double wall = 0;
+	double cpu = 0;
+	//Growth of the peak resident set size in bytes. The peak never drops, so a stage only shows
+	//memory it takes beyond the largest amount used before.
+	long long peakRss = 0;
+	//Heap allocations made in the stage, -1 unless counted, see heapAllocations
+	long long allocations = -1;
+};
+
+//Named counts, like sizes of the stage results, in the order they are reported
+typedef std::vector<std::pair<std::string, long long> > StatCounts;
+
+//Class StageTimes: Wall clock time, CPU time and memory of the pipeline stages, in the order they ran.
+//CPU time, memory and allocations are counted for the whole process, so stages running concurrently
+//on other threads show up in each other's samples.
+
+class StageTimes
+{
+	//Every finished stage
+	std::vector<StageSample> stages;
+
+	//Counters at the end of the previous stage
+	std::chrono::steady_clock::time_point last;
+	double lastCpu;
+	long long lastPeak;
+	long long lastAllocations;
+	public:
+		StageTimes() {restart();}
+
+		//Drops the recorded stages and starts timing the next one from now
+		void restart()
+		{
+			stages.clear();
+			skip();
+		}
+
+		//Starts timing the next stage from now, leaving out the time since the previous one
+		void skip();
+
+		//Ends the stage that ran since the previous call, or since construction, and records it as name
+		void lap(const std::string& name);
+
+		//Adds the stages of other, which ran since the previous stage, and continues timing from now
+		void append(const StageTimes& other);
+
+		//Accessors
+		const std::vector<StageSample>& getStages() const {return stages;}
+		double total() const
+		{
+			double sum = 0;
+			for(const auto& stage : stages) sum += stage.wall;
+			return sum;
+		}
+};
+
+//Writes times and counts to path as one JSON object:
+//	{"stages":[{"name":"decode","wallSeconds":0.001,"cpuSeconds":0.001,"peakRssDeltaBytes":4096}, ...],
+//	 "totalWallSeconds":0.05,"counts":{"pixels":1024, ...}}
+//Stages carry "heapAllocations" as well when allocations are counted.
+//Returns false if the file couldn't be written completely.
+bool writeStatsJson(const std::string& path, const StageTimes& times, const StatCounts& counts);
+
+#endif
@@ -3,21 +3,58 @@
 #include "graph.h"
 #include "voronoi.h"
 #include "spline.h"
+#include "region.h"
+#include "pipeline.h"
+#include "BMP.h"
 #include "simple-svg.hpp"
+#include "svgshapes.h"
+#include "threadpool.h"
+#include "files.h"
 
 #include <iostream>
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <unordered_map>
 
 using namespace std;
-unsigned IMAGE_SCALE = 10;
 
-uint8_t rotateLevel = 0;
+//Settings of the SVG output, the stages take a PipelineOptions
+struct SvgOptions
+{
+	//Output pixels per image pixel
+	unsigned scale = 10;
+	//Emit splines as flattened polylines instead of Bezier paths
+	bool flattenSplines = false;
+	//Emit one path per fill color instead of one element per cell or region
+	bool batchColors = false;
+	//Maximum distance in output pixels between a spline and its flattened polyline
+	float flatness = 0.2f;
+	//Decimals of the output coordinates, negative for the shortest round-trip form
+	int precision = 3;
+	//Compact encoding: relative integer coordinates on a 1/8 pixel lattice and CSS color classes
+	bool compact = false;
+	//Write gzip compressed .svgz
+	bool compress = false;
+	//Also dump the cells in the binary layout of Voronoi::printVoronoiBinary
+	bool dumpBinary = false;
+	//Write the cost of every step and the result sizes to <<name>>.stats.json
+	bool stats = false;
+};
+
+//Shapes formatted per task
+const int SHAPES_PER_BAND = 2048;
 
-//Global vars for use in render()
-Image* gImage = nullptr;
-Graph* gSimilarity = nullptr;
-Voronoi* gDiagram = nullptr;
-Spline* gCurves = nullptr;
-vector<pair<vector<Point>,Color> > mainOutLine;
+//Document being drawn, with the pool formatting its shapes and the output settings
+struct Canvas
+{
+	svg::Document& doc;
+	ThreadPool& pool;
+	const SvgOptions& options;
+};
 
 //Pretty Print graph to std::cout
 void printGraph(Graph& g)
@@ -40,125 +77,406 @@ void printGraph(Graph& g)
 	}
 }
 
-#define draw(x, y) svg::Point(IMAGE_SCALE * x, IMAGE_SCALE * y)
-#define HALF_UNIT IMAGE_SCALE * 0.5f
-
-//Function to draw a closed convex polygon with fill color.
-void drawPolygon(svg::Document &doc, std::vector<pair<float,float> > hull, const Color& c)
+//Formats shapes [0, count) in bands of SHAPES_PER_BAND on the pool and appends the bands to the document in
+//order, so the output is the same as drawing the shapes one by one. format(out, i) writes shape i to out.
+//Only a few bands per worker are formatted ahead of the document, which keeps streaming output bounded.
+template<typename F>
+void drawBands(Canvas &canvas, int count, F format)
 {
-	svg::Polygon polygon(svg::Color(c.R, c.G, c.B));
-	for (const auto& point : hull) polygon << draw(X(point), Y(point));
-	doc << polygon;
+	int bands = (count + SHAPES_PER_BAND - 1) / SHAPES_PER_BAND;
+	int window = 4 * canvas.pool.size();
+	vector<Fragment> parts(min(window, bands), Fragment{std::string(), &canvas.doc.getLayout(), (float)canvas.options.scale});
+	TaskGroup group;
+	for(int first = 0; first < bands; first += window)
+	{
+		int last = min(bands, first + window);
+		for(int b = first; b < last; b++)
+			canvas.pool.submit([&, b]()
+			{
+				Fragment& out = parts[b - first];
+				out.text.clear();
+				for(int i = b * SHAPES_PER_BAND; i < min(count, (b + 1) * SHAPES_PER_BAND); i++) format(out, i);
+			}, group);
+		canvas.pool.wait(group);
+		for(int b = first; b < last; b++) canvas.doc.appendFragment(parts[b - first].text);
+	}
 }
 
-// calculates 1(x1)+t(x2)+t^2(x3) for bspline points
-inline float evalBspline(float x1, float x2, float x3, float t) { return x1 + x2*t + x3*t*t; }
-
-// Function to draw a q-u-b spline curve from 3 control points
-void drawSpline(svg::Document &doc, pair<float,float> p1, pair<float,float> p2, pair<float,float> p3, const Color &color)
+// Function to draw the flattened q-u-b spline segments of all curves, one polyline per segment
+void drawSplines(Canvas &canvas, const SplineBatch& batch)
 {
-	vector<vector<float>> matrix = gCurves->getSpline({p1,p2,p3});
-	//T is extroplated a little for intersecting pieces
+	// T is extroplated a little for intersecting pieces
+	vector<float> xs, ys;
+	vector<int> offsets;
+	batch.tessellate(canvas.options.flatness, canvas.options.scale, -0.1f, 1.1f, xs, ys, offsets);
 
-	// parameter t that will generate all the points
-	float t = -0.1f;
+	drawBands(canvas, batch.getCurveCount(), [&](Fragment& out, int c)
+	{
+		const Color& color = batch.getColor(c);
+		for(int s = batch.getCurveBegin(c); s < batch.getCurveEnd(c); s++)
+		{
+			svg::Polyline poly_line(svg::Stroke(1, svg::Color(color.R, color.G, color.B)));
+			for(int k = offsets[s]; k < offsets[s + 1]; k++) poly_line << out.at(xs[k], ys[k]);
+			out << poly_line;
+		}
+	});
+}
 
-	// increment t by steps
-	float step = 0.01f;
+//Function to draw the cells, or the regions, of every fill color as one even-odd path.
+//Cells and regions never overlap, so the subpaths fill exactly what the separate elements did.
+//Paths come in the order of the first cell or region of their color.
+void drawBatched(Canvas &canvas, Pipeline& pipeline)
+{
+	Image& image = *pipeline.getImage();
+	//Shapes to draw, either every cell or every region
+	vector<const vector<Point>*> rings;
+	vector<int> shapeOf;
+	vector<Color> colors;
+	if(pipeline.getRegions())
+	{
+		const auto& regions = pipeline.getRegions()->getRegions();
+		for(int r = 0; r < regions.size(); r++)
+		{
+			colors.push_back(regions[r].color);
+			for(const auto& ring : regions[r].rings)
+			{
+				rings.push_back(&ring);
+				shapeOf.push_back(r);
+			}
+		}
+	}
+	else
+	{
+		for(int x = 0 ; x < image.getWidth(); x++)
+		for(int y = 0 ; y < image.getHeight(); y++)
+		{
+			colors.push_back(image(x,y)->color());
+			rings.push_back(&pipeline.getDiagram().getHull(x,y));
+			shapeOf.push_back(colors.size() - 1);
+		}
+	}
 
-	// store x,y after multiplying with 1, t and t^2
-	float xcor, ycor;
+	//Bucket the rings by exact fill color
+	unordered_map<uint32_t, int> groupOf;
+	vector<int> groupOfRing(rings.size());
+	vector<int> groupOffset(1, 0);
+	vector<Color> groupColor;
+	for(int i = 0; i < rings.size(); i++)
+	{
+		const Color& c = colors[shapeOf[i]];
+		uint32_t key = (c.R << 16) | (c.G << 8) | c.B;
+		auto it = groupOf.find(key);
+		if(it == groupOf.end())
+		{
+			it = groupOf.emplace(key, groupColor.size()).first;
+			groupColor.push_back(c);
+			groupOffset.push_back(0);
+		}
+		groupOfRing[i] = it->second;
+		groupOffset[it->second + 1]++;
+	}
+	for(int g = 0; g < groupColor.size(); g++) groupOffset[g + 1] += groupOffset[g];
+	vector<int> order(rings.size());
+	vector<int> fill(groupOffset.begin(), groupOffset.end() - 1);
+	for(int i = 0; i < rings.size(); i++) order[fill[groupOfRing[i]]++] = i;
 
-	svg::Polyline poly_line(svg::Stroke(1, svg::Color(color.R, color.G, color.B)));
-	for(;t<=1.1f; t+=step) poly_line << draw(evalBspline(matrix[0][0],matrix[1][0],matrix[2][0],t), evalBspline(matrix[0][1],matrix[1][1],matrix[2][1],t));
-	doc << poly_line;
+	drawBands(canvas, groupColor.size(), [&](Fragment& out, int g)
+	{
+		const Color& c = groupColor[g];
+		svg::Path path(svg::Color(c.R, c.G, c.B));
+		for(int k = groupOffset[g]; k < groupOffset[g + 1]; k++)
+		{
+			path.startNewSubPath();
+			for(const auto& point : *rings[order[k]]) path << out.at(X(point), Y(point));
+		}
+		out << path;
+	});
 }
 
-void drawCell(svg::Document& doc, int x, int y, const Color& c) {
+void drawCell(Fragment& doc, int x, int y, const Color& c) {
 	float cx = x + 0.5f;
 	float cy = y + 0.5f;
 	doc << (svg::Polygon(svg::Color(c.R, c.G, c.B))
-		<< draw(cx - HALF_UNIT, cy - HALF_UNIT)
-		<< draw(cx + HALF_UNIT, cy - HALF_UNIT)
-		<< draw(cx + HALF_UNIT, cy + HALF_UNIT)
-		<< draw(cx - HALF_UNIT, cy + HALF_UNIT)
+		<< doc.at(cx - 0.5f, cy - 0.5f)
+		<< doc.at(cx + 0.5f, cy - 0.5f)
+		<< doc.at(cx + 0.5f, cy + 0.5f)
+		<< doc.at(cx - 0.5f, cy + 0.5f)
 	);
 }
 
 //Render Function
-void drawImage(svg::Document &doc)
+void drawImage(Canvas &canvas, Pipeline& pipeline)
 {
-	//Draw Voronoi Diagrams
-	for(int x = 0 ; x < gImage->getWidth(); x++)
-	for(int y = 0 ; y < gImage->getHeight(); y++)
+	Image& image = *pipeline.getImage();
+	//Draw merged regions if requested, Voronoi cells otherwise
+	if(canvas.options.batchColors)
+	{
+		drawBatched(canvas, pipeline);
+	}
+	else if(pipeline.getRegions())
 	{
-		auto hull = (*gDiagram)(x,y);
-		//Fill Polygon
-		drawPolygon(doc, hull, (*gImage)(x,y)->color());
+		const auto& regions = pipeline.getRegions()->getRegions();
+		drawBands(canvas, regions.size(), [&](Fragment& out, int r) { drawRegion(out, regions[r]); });
+	}
+	else
+	{
+		//Cells go column by column, band b holds the cells b * SHAPES_PER_BAND onwards of that order
+		int height = image.getHeight();
+		drawBands(canvas, image.getWidth() * height, [&](Fragment& out, int i)
+		{
+			int x = i / height, y = i % height;
+			//Fill Polygon
+			drawPolygon(out, pipeline.getDiagram().getHull(x,y), image(x,y)->color());
+		});
 	}
 
-	for(pair<vector<Point>,Color> curve: mainOutLine)
+	const auto& curves = pipeline.getCurves();
+	if(canvas.options.flattenSplines)
+	{
+		SplineBatch batch;
+		batch.build(curves);
+		drawSplines(canvas, batch);
+	}
+	else
 	{
-		auto points = curve.first;
-		auto color = curve.second;
-		if(points.size() < 2) continue;
-		for(int i = 0; i < points.size()-2; i++)
-			drawSpline(doc, points[i],points[(i+1)%points.size()],points[(i+2)%points.size()], color);
+		drawBands(canvas, curves.size(), [&](Fragment& out, int c) { drawCurve(out, curves[c].first, curves[c].second); });
 	}
 }
 
-int main(int argc, char** argv)
+//Body of convert, which turns exceptions into errors
+bool convertImage(const std::string& input, Pipeline& pipeline, const PipelineOptions& stages, const SvgOptions& options,
+	ThreadPool& pool, std::string& error)
 {
-	if (argc > 2) {
-		std::cout << "Usage: " << argv[0] << " <<bmp filename without extension>>" << endl;
-		return 1;
+	std::string output_path = input + (options.compress ? ".svgz" : ".svg");
+	std::string json_path = input + ".json";
+
+	//Image contains Pixel Data
+	StageTimes times;
+	BMP bitmap((input + ".bmp").c_str());
+	times.lap("decode");
+	Image inputImage(bitmap);
+	times.lap("image");
+
+	//Planarize the similarity graph, reshape the pixels, merge the regions if asked for and fit the
+	//B-Splines on the outlines of the active Voronoi edges
+	pipeline.setImage(inputImage);
+	pipeline.run(stages, &pool);
+	times.append(pipeline.getTimes());
+
+	Voronoi& diagram = pipeline.getDiagram();
+	if (!diagram.printVoronoi(json_path))
+		error = "couldn't write " + json_path;
+	if (options.dumpBinary && !diagram.printVoronoiBinary(input + ".dpxv"))
+		error = "couldn't write " + input + ".dpxv";
+	times.lap("dumpVoronoi");
+
+	//Output Image
+	svg::Dimensions dimensions(options.scale * inputImage.getWidth(), options.scale * inputImage.getHeight());
+	svg::Layout layout(dimensions, svg::Layout::TopLeft);
+	layout.precision = options.precision;
+	svg::Palette palette;
+	if(options.compact)
+	{
+		//Cell corners sit on the 1/4 pixel lattice and curve midpoints on the 1/8 one, so
+		//integers in 1/8 pixel units keep them exact. The view box scales back to the output size.
+		layout.scale = 8.0 / options.scale;
+		layout.precision = 0;
+		layout.compact = true;
+		//Every fill and stroke takes a pixel color, so the palette is known before the first shape
+		for(int x = 0; x < inputImage.getWidth(); x++)
+			for(int y = 0; y < inputImage.getHeight(); y++)
+			{
+				const Color& c = inputImage(x,y)->color();
+				palette.add(svg::Color(c.R, c.G, c.B));
+			}
+		layout.palette = &palette;
 	}
-	if (argc == 1) {
-		argv[1] = "boo";	// To zmieniaj jak chcesz szybko testować
-		std::cout << "Missing arguments, debug file: " << argv[1] << ".bmp" << endl;
+	svg::Document doc(output_path, layout, true, options.compress);
+
+	Canvas canvas{doc, pool, options};
+	drawImage(canvas, pipeline);
+
+	if (!doc.save()) error = "couldn't write " + output_path;
+	times.lap("output");
+
+	if (options.stats)
+	{
+		StatCounts counts = pipeline.getCounts();
+		counts.emplace_back("outputBytes", fileSize(output_path));
+		if (!writeStatsJson(input + ".stats.json", times, counts))
+			error = "couldn't write " + input + ".stats.json";
 	}
-	
-	std::string output_path = std::string(argv[1]) + ".svg";
-	std::string json_path = std::string(argv[1]) + ".json";
+	return error.empty();
+}
 
-	//Image contains Pixel Data
-	Image inputImage = Image(string(argv[1]) + ".bmp");
-	gImage = &inputImage;
+//Depixelizes <<input>>.bmp into <<input>>.svg, or .svgz, and dumps the cells next to it. Shapes are formatted
+//on pool, the stages run on pipeline and reuse its buffers. Safe to call from tasks of pool.
+//Returns false with error set if the image couldn't be read or an output couldn't be written.
+bool convert(const std::string& input, Pipeline& pipeline, const PipelineOptions& stages, const SvgOptions& options,
+	ThreadPool& pool, std::string& error)
+{
+	try
+	{
+		return convertImage(input, pipeline, stages, options, pool, error);
+	}
+	catch(const std::exception& e)
+	{
+		error = e.what();
+		return false;
+	}
+}
 
-	////Create Similarity Graph
-	Graph similarity(inputImage);
-	gSimilarity = &similarity;
-	//Planarize the graph
-	similarity.planarize();
+//Outcome of one file of a batch
+struct BatchResult
+{
+	bool ok;
+	std::string error;
+	double seconds;
+};
 
-	////Test planarized similarity graph
-	////printGraph(similarity);
+//Converts every <<input>>.bmp of inputs on pool, one task per file and largest files first, so that no big
+//file is left to finish alone at the end. The parallel steps of a file (active edges, tracing, optimization
+//and formatting) still run on the whole pool. Every task takes an idle pipeline, so their buffers get
+//reused across files. A failed file doesn't stop the others, every file is reported as it finishes.
+//Returns the number of failed files.
+int convertAll(const vector<string>& inputs, const PipelineOptions& stages, const SvgOptions& options, ThreadPool& pool)
+{
+	vector<int> order(inputs.size());
+	vector<long long> sizes(inputs.size());
+	for(int i = 0; i < inputs.size(); i++)
+	{
+		order[i] = i;
+		sizes[i] = fileSize(inputs[i] + ".bmp");
+	}
+	stable_sort(order.begin(), order.end(), [&](int a, int b) { return sizes[a] > sizes[b]; });
 
-	//Create Voronoi diagram for reshaping the pixels
-	Voronoi diagram(inputImage);
-	gDiagram = &diagram;
-	diagram.createDiagram(similarity);
-	diagram.printVoronoi(json_path);
+	vector<BatchResult> results(inputs.size());
+	vector<unique_ptr<Pipeline> > idle;
+	std::mutex lock;
+	for(int i : order)
+		pool.submit([&, i]()
+		{
+			unique_ptr<Pipeline> pipeline;
+			{
+				std::lock_guard<std::mutex> guard(lock);
+				if(!idle.empty())
+				{
+					pipeline = std::move(idle.back());
+					idle.pop_back();
+				}
+			}
+			if(!pipeline) pipeline.reset(new Pipeline());
 
-	////Create B-Splines on the end points of Voronoi edges.
-	Spline curves(&diagram);
-	//gCurves = &curves;
-	//curves.extractActiveEdges();
-	//curves.calculateGraph();
+			auto start = std::chrono::steady_clock::now();
+			long long allocations = heapAllocations();
+			BatchResult& result = results[i];
+			result.ok = convert(inputs[i], *pipeline, stages, options, pool, result.error);
+			result.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+			if(allocations >= 0) allocations = heapAllocations() - allocations;
 
-	//// Check the graph here
+			std::lock_guard<std::mutex> guard(lock);
+			idle.push_back(std::move(pipeline));
+			if(result.ok)
+			{
+				//Allocations are counted process wide, other workers' show up as well
+				std::cout << "ok      " << inputs[i] << ".bmp " << result.seconds * 1000 << " ms";
+				if(allocations >= 0) std::cout << ", " << allocations << " heap allocations";
+				std::cout << endl;
+			}
+			else std::cout << "failed  " << inputs[i] << ".bmp: " << result.error << endl;
+		});
+	pool.wait();
 
-	//// mainOutLine contains all the outline edges where we will fit the b-splines
-	//mainOutLine = curves.printGraph();
-	////std::cout << mainOutLine << endl;
-	//Optimize B-Splines
+	int failed = count_if(results.begin(), results.end(), [](const BatchResult& r) { return !r.ok; });
+	std::cout << inputs.size() - failed << " of " << inputs.size() << " files converted";
+	if(failed)
+	{
+		std::cout << ", failed:";
+		for(int i = 0; i < inputs.size(); i++) if(!results[i].ok) std::cout << " " << inputs[i] << ".bmp";
+	}
+	std::cout << endl;
+	return failed;
+}
 
-	//Output Image
-	svg::Dimensions dimensions(IMAGE_SCALE * inputImage.getWidth(), IMAGE_SCALE * inputImage.getHeight());
-	svg::Document doc(output_path, svg::Layout(dimensions, svg::Layout::TopLeft));
+int main(int argc, char** argv)
+{
+	std::string input;
+	//The edge grid dump goes to std::cout as before
+	PipelineOptions stages;
+	stages.dumpEdges = true;
+	SvgOptions options;
+	//Batch inputs, and worker threads with 0 for one per hardware thread
+	std::string files;
+	int workers = 0;
+	for (int i = 1; i < argc; i++) {
+		std::string arg = argv[i];
+		if (arg == "--regions") stages.mergeRegions = true;
+		else if (arg == "--files" && i + 1 < argc) files = argv[++i];
+		else if (arg == "--workers" && i + 1 < argc) workers = atoi(argv[++i]);
+		else if (arg == "--polylines") options.flattenSplines = true;
+		else if (arg == "--batch") options.batchColors = true;
+		else if (arg == "--flatness" && i + 1 < argc) options.flatness = atof(argv[++i]);
+		else if (arg == "--iterations" && i + 1 < argc) stages.optimize.iterations = atoi(argv[++i]);
+		else if (arg == "--tolerance" && i + 1 < argc) stages.optimize.tolerance = atof(argv[++i]);
+		else if (arg == "--precision" && i + 1 < argc) options.precision = atoi(argv[++i]);
+		else if (arg == "--compact") options.compact = true;
+		else if (arg == "--voronoi-bin") options.dumpBinary = true;
+		else if (arg == "--stats") options.stats = true;
+#ifdef SIMPLE_SVG_ZLIB
+		else if (arg == "--svgz") options.compress = true;
+#endif
+		else if (input.empty() && files.empty() && arg.compare(0, 2, "--") != 0) input = arg;
+		else {
+			std::cout << "Usage: " << argv[0] << " [--regions] [--batch] [--polylines] [--flatness px] [--iterations n] [--tolerance px] [--precision n] [--compact] [--svgz] [--voronoi-bin] [--stats] [--workers n] <<bmp filename without extension>>" << endl;
+			std::cout << "       " << argv[0] << " [options] --files <<directory, pattern or manifest>>" << endl;
+			std::cout << "  --regions       merge connected cells of the same color into one path each" << endl;
+			std::cout << "  --batch         write one path per fill color, combined with --regions too" << endl;
+			std::cout << "  --polylines     write splines as flattened polylines instead of Bezier paths" << endl;
+			std::cout << "  --flatness px   polyline flattening tolerance in output pixels (default " << options.flatness << ")" << endl;
+			std::cout << "  --iterations n  spline optimization sweeps, 0 disables it (default " << stages.optimize.iterations << ")" << endl;
+			std::cout << "  --tolerance px  stop optimizing a curve once it moves less (default " << stages.optimize.tolerance << ")" << endl;
+			std::cout << "  --precision n   decimals of the output coordinates, -1 for shortest round-trip (default " << options.precision << ")" << endl;
+			std::cout << "  --compact       relative integer coordinates on a 1/8 pixel grid and shared CSS colors" << endl;
+#ifdef SIMPLE_SVG_ZLIB
+			std::cout << "  --svgz          write gzip compressed <<name>>.svgz" << endl;
+#else
+			std::cout << "  --svgz          not available, built without zlib" << endl;
+#endif
+			std::cout << "  --voronoi-bin   also write the cells to <<name>>.dpxv in the binary layout" << endl;
+			std::cout << "  --stats         write the time, CPU time and peak memory growth of every step and the" << endl;
+			std::cout << "                  result sizes to <<name>>.stats.json" << endl;
+			std::cout << "  --files spec    convert every .bmp of a directory, every match of a pattern like dir/*.bmp," << endl;
+			std::cout << "                  or every path listed in a manifest file, and report each file" << endl;
+			std::cout << "  --workers n     worker threads of all parallel steps, 0 for one per core (default " << workers << ")" << endl;
+			return 1;
+		}
+	}
+	ThreadPool pool(workers);
 
-	drawImage(doc);
+	if (!files.empty()) {
+		vector<string> paths;
+		std::string error;
+		if (!listInputs(files, ".bmp", paths, error)) {
+			std::cout << "Couldn't list inputs: " << error << endl;
+			return 1;
+		}
+		//Outputs go next to the inputs
+		for (auto& path : paths)
+			if (path.size() > 4 && path.compare(path.size() - 4, 4, ".bmp") == 0) path.resize(path.size() - 4);
+		//Edge grids of parallel files would only interleave
+		stages.dumpEdges = false;
+		return convertAll(paths, stages, options, pool) ? 1 : 0;
+	}
+	if (input.empty()) {
+		input = "boo";	// To zmieniaj jak chcesz szybko testować
+		std::cout << "Missing arguments, debug file: " << input << ".bmp" << endl;
+	}
 
-	doc.save();
+	Pipeline pipeline;
+	std::string error;
+	if (!convert(input, pipeline, stages, options, pool, error)) {
+		std::cout << "Couldn't convert " << input << ".bmp: " << error << endl;
+		return 1;
+	}
 	return 0;
-}
\ No newline at end of file
+}
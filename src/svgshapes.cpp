@@ -0,0 +1,40 @@
+#include "svgshapes.h"
+
+void drawPolygon(Fragment &doc, const std::vector<Point>& hull, const Color& c)
+{
+	svg::Polygon polygon(svg::Color(c.R, c.G, c.B));
+	for (const auto& point : hull) polygon << doc.at(X(point), Y(point));
+	doc << polygon;
+}
+
+// A uniform quadratic B-spline segment is the quadratic Bezier from the midpoint of its first two
+// control points to the midpoint of its last two, with the middle control point as Bezier control.
+void drawCurve(Fragment &doc, const std::vector<Point>& points, const Color &color)
+{
+	if(points.size() < 3) return;
+	auto mid = [](const Point& a, const Point& b) { return Point((X(a) + X(b)) * 0.5f, (Y(a) + Y(b)) * 0.5f); };
+
+	svg::QuadraticPath path(svg::Stroke(1, svg::Color(color.R, color.G, color.B)));
+	Point start = mid(points[0], points[1]);
+	path.moveTo(doc.at(X(start), Y(start)));
+	for(int i = 1; i + 1 < points.size(); i++)
+	{
+		Point end = mid(points[i], points[i + 1]);
+		path.quadTo(doc.at(X(points[i]), Y(points[i])), doc.at(X(end), Y(end)));
+	}
+	doc << path;
+}
+
+void drawRegion(Fragment &doc, const Region& region)
+{
+	//Regions made only of degenerate cells have no area
+	if (region.rings.empty()) return;
+	const Color& c = region.color;
+	svg::Path path(svg::Color(c.R, c.G, c.B));
+	for (const auto& ring : region.rings)
+	{
+		path.startNewSubPath();
+		for (const auto& point : ring) path << doc.at(X(point), Y(point));
+	}
+	doc << path;
+}
@@ -0,0 +1,46 @@
+#pragma once
+
+#ifndef _SVGSHAPES_H
+#define _SVGSHAPES_H
+
+#include "common.h"
+#include "region.h"
+#include "simple-svg.hpp"
+
+#include <string>
+#include <vector>
+
+//SVG elements of the stage results, formatted into text with the layout of a document. The SVG
+//front end formats bands of them in parallel and appends the text to its document.
+
+//Text of one band of shapes, formatted with the layout of the document
+struct Fragment
+{
+	std::string text;
+	const svg::Layout* layout;
+	//Output pixels per image pixel
+	float scale;
+
+	Fragment& operator<<(const svg::Shape& shape)
+	{
+		shape.appendTo(text, *layout);
+		return *this;
+	}
+
+	//Output point of image position (x, y)
+	svg::Point at(float x, float y) const
+	{
+		return svg::Point(scale * x, scale * y);
+	}
+};
+
+//Closed polygon of a reshaped cell, filled with c
+void drawPolygon(Fragment& doc, const std::vector<Point>& hull, const Color& c);
+
+//Traced curve as a single path of quadratic Bezier segments, stroked with color
+void drawCurve(Fragment& doc, const std::vector<Point>& points, const Color& color);
+
+//Merged region with its holes as one even-odd path
+void drawRegion(Fragment& doc, const Region& region);
+
+#endif
@@ -0,0 +1,184 @@
+#include "threadpool.h"
+#include "parallel.h"
+
+//Index of the pool worker running on this thread, -1 outside of pool workers
+static thread_local const ThreadPool* currentPool = nullptr;
+static thread_local int currentWorker = -1;
+
+ThreadPool::ThreadPool(int threads) : pending(0), queued(0), nextQueue(0), stopping(false)
+{
+	if(threads <= 0) threads = hardwareThreads();
+	for(int i = 0; i < threads; i++) queues.emplace_back(new Queue());
+	for(int i = 0; i < threads; i++) workers.emplace_back(&ThreadPool::workerLoop, this, i);
+}
+
+ThreadPool::~ThreadPool()
+{
+	try
+	{
+		wait();
+	}
+	catch(...)
+	{
+		//Nobody is left to report a failure to
+	}
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		stopping = true;
+	}
+	wake.notify_all();
+	for(auto& worker : workers) worker.join();
+}
+
+void ThreadPool::submit(std::function<void()> task)
+{
+	int target = (currentPool == this) ? currentWorker : (int)(nextQueue++ % queues.size());
+	pending++;
+	{
+		std::lock_guard<std::mutex> guard(queues[target]->lock);
+		queues[target]->tasks.push_back(std::move(task));
+	}
+	{
+		//Counting under the lock orders this with a thread about to sleep, so the wake up can't get lost
+		std::lock_guard<std::mutex> guard(sleepLock);
+		queued++;
+	}
+	wake.notify_one();
+	done.notify_all();
+}
+
+bool ThreadPool::runOne(int self)
+{
+	std::function<void()> task;
+	int n = queues.size();
+
+	//Own work first, newest task
+	if(self >= 0)
+	{
+		std::lock_guard<std::mutex> guard(queues[self]->lock);
+		if(!queues[self]->tasks.empty())
+		{
+			task = std::move(queues[self]->tasks.back());
+			queues[self]->tasks.pop_back();
+		}
+	}
+
+	//Otherwise steal the oldest task of someone else
+	for(int i = 1; !task && i <= n; i++)
+	{
+		int victim = ((self < 0 ? 0 : self) + i) % n;
+		std::lock_guard<std::mutex> guard(queues[victim]->lock);
+		if(!queues[victim]->tasks.empty())
+		{
+			task = std::move(queues[victim]->tasks.front());
+			queues[victim]->tasks.pop_front();
+		}
+	}
+	if(!task) return false;
+	queued--;
+
+	try
+	{
+		task();
+	}
+	catch(...)
+	{
+		std::lock_guard<std::mutex> guard(errorLock);
+		if(!error) error = std::current_exception();
+	}
+	if(--pending == 0)
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		done.notify_all();
+	}
+	return true;
+}
+
+void ThreadPool::submit(std::function<void()> task, TaskGroup& group)
+{
+	std::shared_ptr<TaskGroup::State> state = group.state;
+	state->pending++;
+	{
+		std::lock_guard<std::mutex> guard(state->lock);
+		state->tasks.push_back(std::move(task));
+	}
+	//Workers pick the task up through a stand-in, which finds nothing if a waiting thread got to it first
+	submit([this, state]() { runGrouped(*state); });
+}
+
+bool ThreadPool::runGrouped(TaskGroup::State& group)
+{
+	std::function<void()> task;
+	{
+		std::lock_guard<std::mutex> guard(group.lock);
+		if(group.tasks.empty()) return false;
+		task = std::move(group.tasks.front());
+		group.tasks.pop_front();
+	}
+
+	try
+	{
+		task();
+	}
+	catch(...)
+	{
+		std::lock_guard<std::mutex> guard(group.lock);
+		if(!group.error) group.error = std::current_exception();
+	}
+	if(--group.pending == 0)
+	{
+		std::lock_guard<std::mutex> guard(sleepLock);
+		done.notify_all();
+	}
+	return true;
+}
+
+void ThreadPool::wait(TaskGroup& group)
+{
+	TaskGroup::State& state = *group.state;
+	while(state.pending > 0)
+	{
+		if(runGrouped(state)) continue;
+		//The rest of the group is running on other threads
+		std::unique_lock<std::mutex> guard(sleepLock);
+		done.wait(guard, [&state]() { return state.pending == 0; });
+	}
+
+	std::exception_ptr failure;
+	{
+		std::lock_guard<std::mutex> guard(state.lock);
+		std::swap(failure, state.error);
+	}
+	if(failure) std::rethrow_exception(failure);
+}
+
+void ThreadPool::workerLoop(int self)
+{
+	currentPool = this;
+	currentWorker = self;
+	while(true)
+	{
+		if(runOne(self)) continue;
+		std::unique_lock<std::mutex> guard(sleepLock);
+		wake.wait(guard, [this]() { return stopping || queued > 0; });
+		if(stopping) return;
+	}
+}
+
+void ThreadPool::wait()
+{
+	int self = (currentPool == this) ? currentWorker : -1;
+	while(pending > 0)
+	{
+		if(runOne(self)) continue;
+		std::unique_lock<std::mutex> guard(sleepLock);
+		done.wait(guard, [this]() { return pending == 0 || queued > 0; });
+	}
+
+	std::exception_ptr failure;
+	{
+		std::lock_guard<std::mutex> guard(errorLock);
+		std::swap(failure, error);
+	}
+	if(failure) std::rethrow_exception(failure);
+}
@@ -0,0 +1,106 @@
+#pragma once
+
+#ifndef _THREADPOOL_H
+#define _THREADPOOL_H
+
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+//Class TaskGroup: Tasks submitted to a ThreadPool that are waited for together.
+//Waiting for a group only runs tasks of that group on the waiting thread, so tasks can wait for
+//groups of their own without blocking the pool or piling up unrelated work on their stack.
+
+class TaskGroup
+{
+	friend class ThreadPool;
+
+	//Shared with the pool, which may still hold stale references after the group is gone
+	struct State
+	{
+		std::mutex lock;
+		//Tasks not started yet, oldest first
+		std::deque<std::function<void()> > tasks;
+		//Tasks submitted but not finished yet
+		std::atomic<int> pending;
+		//First exception thrown by a task since the last wait
+		std::exception_ptr error;
+		State() : pending(0) {}
+	};
+	std::shared_ptr<State> state;
+	public:
+		TaskGroup() : state(std::make_shared<State>()) {}
+};
+
+//Class ThreadPool: Work-stealing pool for tasks of very different sizes.
+//Every worker has its own task deque. Workers run their newest task first and, once out of work,
+//steal the oldest task of another worker, so big tasks don't leave the other cores idle.
+
+class ThreadPool
+{
+	struct Queue
+	{
+		std::mutex lock;
+		std::deque<std::function<void()> > tasks;
+	};
+
+	std::vector<std::unique_ptr<Queue> > queues;
+	std::vector<std::thread> workers;
+
+	//Tasks submitted but not finished yet, and the part of them still waiting in a deque
+	std::atomic<int> pending;
+	std::atomic<int> queued;
+	//Round robin target for tasks submitted from outside the pool
+	std::atomic<unsigned> nextQueue;
+	bool stopping;
+
+	std::mutex sleepLock;
+	std::condition_variable wake;
+	std::condition_variable done;
+
+	//First exception thrown by a task since the last wait()
+	std::mutex errorLock;
+	std::exception_ptr error;
+
+	//Runs one task, from queue self if possible and stolen otherwise. Returns false if there was none.
+	bool runOne(int self);
+
+	//Runs the oldest task not started yet of group. Returns false if there was none.
+	bool runGrouped(TaskGroup::State& group);
+	void workerLoop(int self);
+
+	public:
+		//Starts threads workers, 0 picks one per hardware thread
+		ThreadPool(int threads = 0);
+		~ThreadPool();
+
+		ThreadPool(const ThreadPool&) = delete;
+		ThreadPool& operator=(const ThreadPool&) = delete;
+
+		//Queues a task. Tasks may submit further tasks, those go to the submitting worker's own deque.
+		void submit(std::function<void()> task);
+
+		//Blocks until every submitted task has finished, running tasks on the calling thread meanwhile.
+		//If tasks threw, the first of their exceptions is rethrown once all of them are done.
+		//A task waiting like this would wait for itself, tasks wait for a TaskGroup instead.
+		void wait();
+
+		//Queues a task of group. Any worker may run it, as may a thread waiting for the group.
+		void submit(std::function<void()> task, TaskGroup& group);
+
+		//Blocks until every task of group has finished, running tasks of the group on the calling thread
+		//meanwhile. Can be called from tasks. If tasks of the group threw, the first of their exceptions
+		//is rethrown once all of them are done.
+		void wait(TaskGroup& group);
+
+		//Accessors
+		int size() const {return workers.size();}
+};
+
+#endif
@@ -0,0 +1,112 @@
+#include "tiled.h"
+
+#include <algorithm>
+
+TiledVoronoi::TiledVoronoi(Image& inputImage, int tileSize, int apron, size_t budget)
+{
+	this->imageRef = &inputImage;
+	this->tileSize = std::max(tileSize, 1);
+	this->apron = std::max(apron, 1);
+	this->budget = budget;
+	this->usedBytes = 0;
+	this->request = 0;
+	tilesX = (imageRef->getWidth() + this->tileSize - 1) / this->tileSize;
+	tilesY = (imageRef->getHeight() + this->tileSize - 1) / this->tileSize;
+}
+
+void TiledVoronoi::computeTile(Tile& tile)
+{
+	int w = imageRef->getWidth();
+	int h = imageRef->getHeight();
+
+	//Crop the tile widened by the apron, clipped to the image
+	int cx0 = std::max(tile.x0 - apron, 0);
+	int cy0 = std::max(tile.y0 - apron, 0);
+	int cx1 = std::min(tile.x0 + tile.width + apron, w);
+	int cy1 = std::min(tile.y0 + tile.height + apron, h);
+	Image crop(*imageRef, cx0, cy0, cx1 - cx0, cy1 - cy0);
+
+	Graph similarity(crop);
+	similarity.planarize(false);
+	Voronoi diagram(crop);
+	diagram.createDiagram(similarity);
+
+	//Keep only the cells of the tile itself, moved back into image coordinates
+	tile.cells.resize(tile.width * tile.height);
+	tile.bytes = sizeof(Tile) + tile.cells.size() * sizeof(std::vector<Point>);
+	for(int x = 0; x < tile.width; x++)
+		for(int y = 0; y < tile.height; y++)
+		{
+			std::vector<Point>& cell = tile.cells[x * tile.height + y];
+			cell = diagram.getHull(tile.x0 + x - cx0, tile.y0 + y - cy0);
+			for(Point& p : cell)
+			{
+				p.first += cx0;
+				p.second += cy0;
+			}
+			tile.bytes += cell.capacity() * sizeof(Point);
+		}
+}
+
+TiledVoronoi::Tile& TiledVoronoi::fetch(int tx, int ty)
+{
+	int key = ty * tilesX + tx;
+	auto it = cache.find(key);
+	if(it != cache.end())
+	{
+		//Hit, move to the front
+		lru.splice(lru.begin(), lru, it->second);
+		lru.front().lastUse = request;
+		return lru.front();
+	}
+
+	Tile tile;
+	tile.x0 = tx * tileSize;
+	tile.y0 = ty * tileSize;
+	tile.width = std::min(tileSize, (int)imageRef->getWidth() - tile.x0);
+	tile.height = std::min(tileSize, (int)imageRef->getHeight() - tile.y0);
+	tile.lastUse = request;
+	computeTile(tile);
+
+	usedBytes += tile.bytes;
+	lru.push_front(std::move(tile));
+	cache[key] = lru.begin();
+	evict();
+	return lru.front();
+}
+
+void TiledVoronoi::evict()
+{
+	while(usedBytes > budget && !lru.empty() && lru.back().lastUse != request)
+	{
+		const Tile& victim = lru.back();
+		usedBytes -= victim.bytes;
+		cache.erase((victim.y0 / tileSize) * tilesX + victim.x0 / tileSize);
+		lru.pop_back();
+	}
+}
+
+void TiledVoronoi::requestViewport(int x0, int y0, int x1, int y1)
+{
+	request++;
+	x0 = std::max(x0, 0);
+	y0 = std::max(y0, 0);
+	x1 = std::min(x1, (int)imageRef->getWidth());
+	y1 = std::min(y1, (int)imageRef->getHeight());
+	for(int ty = y0 / tileSize; ty * tileSize < y1; ty++)
+		for(int tx = x0 / tileSize; tx * tileSize < x1; tx++)
+			fetch(tx, ty);
+}
+
+void TiledVoronoi::setMemoryBudget(size_t bytes)
+{
+	budget = bytes;
+	request++;
+	evict();
+}
+
+const std::vector<Point>& TiledVoronoi::getHull(int i, int j)
+{
+	Tile& tile = fetch(i / tileSize, j / tileSize);
+	return tile.cells[(i - tile.x0) * tile.height + (j - tile.y0)];
+}
@@ -0,0 +1,76 @@
+#pragma once
+
+#ifndef _TILED_H
+#define _TILED_H
+
+#include "voronoi.h"
+
+#include <list>
+#include <unordered_map>
+#include <vector>
+
+//Class TiledVoronoi: Lazily evaluated Voronoi diagram for canvases too big to reshape up front.
+//Cells are computed per tile when a viewport touching the tile is requested. Every tile planarizes
+//its own crop of the image, widened by an apron so that the heuristics see the pixels around the
+//tile border. The cells match the ones of a full createDiagram, unless the curves heuristic follows
+//a curve further out than the apron. Computed tiles are kept in an LRU cache bounded in bytes.
+
+class TiledVoronoi
+{
+	struct Tile
+	{
+		//Origin and size of the tile in image pixels
+		int x0, y0, width, height;
+		//Reshaped cells in image coordinates, cells[(x - x0) * height + (y - y0)]
+		std::vector<std::vector<Point>> cells;
+		//Approximate heap usage of the tile
+		size_t bytes;
+		//Request that last touched the tile, tiles of the current request are never evicted
+		unsigned long long lastUse;
+	};
+
+	//Reference to image
+	Image* imageRef;
+
+	int tileSize;
+	int apron;
+	int tilesX, tilesY;
+
+	//Memory budget of the cache in bytes
+	size_t budget;
+	size_t usedBytes;
+	unsigned long long request;
+
+	//Tiles in the order of use, most recent at the front, looked up by ty * tilesX + tx
+	std::list<Tile> lru;
+	std::unordered_map<int, std::list<Tile>::iterator> cache;
+
+	//Returns the tile, computing it on a cache miss
+	Tile& fetch(int tx, int ty);
+
+	//Planarizes and reshapes the apron widened crop of the tile
+	void computeTile(Tile& tile);
+
+	//Drops least recently used tiles not touched by the current request until the budget is met
+	void evict();
+
+	public:
+		//Parametric Constructor
+		TiledVoronoi(Image& inputImage, int tileSize = 64, int apron = 8, size_t budget = 64 << 20);
+
+		//Makes sure all cells intersecting the pixel rectangle [x0,x1) x [y0,y1) are computed
+		void requestViewport(int x0, int y0, int x1, int y1);
+
+		//Changes the memory budget, evicting tiles right away if the cache is over it
+		void setMemoryBudget(size_t bytes);
+
+		//Accessors, computing the owning tile if needed. The returned cell stays valid until the
+		//next requestViewport or setMemoryBudget call.
+		const std::vector<Point>& getHull(int i, int j);
+		Image* getImage() {return imageRef;}
+		size_t getMemoryUsage() const {return usedBytes;}
+		size_t getTileCount() const {return lru.size();}
+		int getTileSize() const {return tileSize;}
+};
+
+#endif
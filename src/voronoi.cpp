@@ -1,27 +1,31 @@
 #include "voronoi.h"
+#include "writer.h"
 #include <iostream>
-#include <fstream>
-#include <sstream>
 
 using namespace std;
 
-int height, width;
-
-void Voronoi::createDiagram(Graph& graph)
+void Voronoi::createDiagram(Graph& graph, StageTimes* times)
 {
-	int h = imageRef->getHeight();
-	int w = imageRef->getWidth();
-
-	height = h;
-	width = w;
+	clear();
+	createRegions(graph);
+	if(times) times->lap("createRegions");
+	collapseValence2();
+	if(times) times->lap("collapseValence2");
+	computeCentroids();
+	if(times) times->lap("centroids");
+}
 
-	for(int i = 0; i < w; i++)
+void Voronoi::clear()
+{
+	//Cells of a previous diagram are emptied, not freed. The grid never shrinks, so a smaller image
+	//keeps the cells a larger one needs again.
+	if(voronoiPts.size() < width) voronoiPts.resize(width);
+	for(int x = 0; x < width; x++)
 	{
-		vector<vector<Point>> v2(h);
-		voronoiPts.push_back(v2);
+		if(voronoiPts[x].size() < height) voronoiPts[x].resize(height);
+		for(int y = 0; y < height; y++) voronoiPts[x][y].clear();
 	}
-	createRegions(graph);
-	collapseValence2();
+	resetArena(arena, valency);
 }
 
 bool Voronoi::onBoundary(Point p)
@@ -29,7 +33,7 @@ bool Voronoi::onBoundary(Point p)
 	return p.first == 0 || p.first == width || p.second == 0 || p.second == height;
 }
 
-pair<float, float> findCentroid(vector<pair<float, float>>& polygon) {
+pair<float, float> findCentroid(const vector<pair<float, float>>& polygon) {
 	float xsum = 0;
 	float ysum = 0;
 	float area = 0;
@@ -51,52 +55,111 @@ pair<float, float> findCentroid(vector<pair<float, float>>& polygon) {
 	return make_pair(xcm, ycm);
 }
 
-string pairToJson(pair<float, float> pair) {
-	ostringstream json;
-	json << "{\"x\":" << pair.first << ",\"y\":" << pair.second << "}";
-	return json.str();
+void Voronoi::computeCentroids()
+{
+	if(centroids.size() < width) centroids.resize(width);
+	for(int i = 0; i < width; i++)
+		if(centroids[i].size() < height) centroids[i].resize(height);
+	for(int i = 0; i < width; i++)
+		for(int j = 0; j < height; j++)
+			centroids[i][j] = findCentroid(voronoiPts[i][j]);
+}
+
+void pairToJson(BufferedWriter& out, const pair<float, float>& pair) {
+	out << "{\"x\":" << pair.first << ",\"y\":" << pair.second << '}';
 }
 
-string polyToJson(const vector<pair<float, float>>& polygon) {
+void polyToJson(BufferedWriter& out, const vector<pair<float, float>>& polygon) {
 	// Format the polygon as a JSON array of objects
-	ostringstream json;
-	json << "\"vertices\":[" << endl;
+	out << "\"vertices\":[\n";
 	for (int i = polygon.size()-1; i>=0; i--) {
-		json << pairToJson(polygon[i]);
-		if (i != 0) json << ",";
-		json << endl;
+		pairToJson(out, polygon[i]);
+		if (i != 0) out << ',';
+		out << '\n';
 	}
-	json << "]";
-	return json.str();
+	out << ']';
 }
 
-void Voronoi::printVoronoi(string json_path)
+bool Voronoi::printVoronoi(string json_path, int precision)
 {
-	Pixel* pixel;
-	pair<float, float> centroid;
-	string vertices;
-	ofstream outfile(json_path);
-	outfile << "{\"width\":" << width << ",\"height\":" << height << "," << endl;
-	outfile << "\"polygons\":[" << endl;
+	BufferedWriter outfile(json_path);
+	if(!outfile.good()) return false;
+	outfile.setPrecision(precision);
+	outfile << "{\"width\":" << width << ",\"height\":" << height << ",\n";
+	outfile << "\"polygons\":[\n";
 
 	for(int i=0; i<width; i++)
 	{
 		for(int j=0; j<height; j++)
 		{
-			pixel = (*imageRef)(i, j);
-			centroid = findCentroid(voronoiPts[i][j]);
-			vertices = polyToJson(voronoiPts[i][j]);
-			
-			outfile << "{" << vertices << "," << endl;
-			outfile << "\"centroid\":" << pairToJson(centroid) << "," << endl;
-			outfile << "\"color\":\"" << pixel->getHexColor() << "\"" << endl;
-			outfile << "}";
-			if (i != width - 1 || j != height - 1) outfile << ",";
-			outfile << endl;
+			outfile << '{';
+			polyToJson(outfile, voronoiPts[i][j]);
+			outfile << ",\n";
+			outfile << "\"centroid\":";
+			pairToJson(outfile, centroids[i][j]);
+			outfile << ",\n";
+			outfile << "\"color\":\"" << (*imageRef)(i, j)->getHexColor() << "\"\n";
+			outfile << '}';
+			if (i != width - 1 || j != height - 1) outfile << ',';
+			outfile << '\n';
 		}
 	}
 	outfile << "]}";
-	outfile.close();
+	return outfile.close();
+}
+
+bool Voronoi::printVoronoiBinary(string bin_path)
+{
+	BufferedWriter outfile(bin_path);
+	if(!outfile.good()) return false;
+
+	uint32_t vertexCount = 0;
+	for(int i = 0; i < width; i++)
+		for(int j = 0; j < height; j++)
+			vertexCount += voronoiPts[i][j].size();
+
+	outfile.write("DPXV", 4);
+	outfile.writeU32(1);
+	outfile.writeU32(width);
+	outfile.writeU32(height);
+	outfile.writeU32(width * height);
+	outfile.writeU32(vertexCount);
+
+	uint32_t offset = 0;
+	for(int i = 0; i < width; i++)
+		for(int j = 0; j < height; j++)
+		{
+			outfile.writeU32(offset);
+			offset += voronoiPts[i][j].size();
+		}
+	outfile.writeU32(offset);
+
+	//Vertices keep the winding of the JSON dump
+	for(int i = 0; i < width; i++)
+		for(int j = 0; j < height; j++)
+			for(int k = voronoiPts[i][j].size() - 1; k >= 0; k--)
+			{
+				outfile.writeF32(voronoiPts[i][j][k].first);
+				outfile.writeF32(voronoiPts[i][j][k].second);
+			}
+
+	for(int i = 0; i < width; i++)
+		for(int j = 0; j < height; j++)
+		{
+			outfile.writeF32(centroids[i][j].first);
+			outfile.writeF32(centroids[i][j].second);
+		}
+
+	for(int i = 0; i < width; i++)
+		for(int j = 0; j < height; j++)
+		{
+			const Color& c = (*imageRef)(i, j)->color();
+			outfile.put(char(c.R));
+			outfile.put(char(c.G));
+			outfile.put(char(c.B));
+			outfile.put(0);
+		}
+	return outfile.close();
 }
 
 /*
@@ -126,13 +189,14 @@ void Voronoi::collapseValence2()
 	{
 		for(int y=0; y< height; y++)
 		{
-			vector<Point> temp;
-			for(int i = 0 ; i < voronoiPts[x][y].size(); i++)
+			//Kept points are moved to the front of the cell in order
+			vector<Point>& cell = voronoiPts[x][y];
+			int kept = 0;
+			for(int i = 0 ; i < cell.size(); i++)
 			{
-				if(valency[voronoiPts[x][y][i]] != 4 || onBoundary(voronoiPts[x][y][i])) temp.push_back(voronoiPts[x][y][i]);
+				if(valency[cell[i]] != 4 || onBoundary(cell[i])) cell[kept++] = cell[i];
 			}
-			voronoiPts[x][y].clear();
-			voronoiPts[x][y] = vector<Point>(temp);
+			cell.resize(kept);
 		}
 	}
 }
@@ -11,33 +11,79 @@ class Voronoi
 	//Reference to image
 	Image* imageRef;
 
-	//Contains voronoi points around every pixel (x,y), in clockwise order starting from top-left
+	//Size of the image in pixels
+	int width, height;
+
+	//Contains voronoi points around every pixel (x,y), in clockwise order starting from top-left.
+	//Grids may be larger than the image, they keep the size of the largest image seen.
 	std::vector<std::vector<std::vector<std::pair<float, float>>>> voronoiPts;
 
+	//Centroid of every reshaped cell, filled once the diagram is complete
+	std::vector<std::vector<Point>> centroids;
+
+	//Holds the valency map, reset with every diagram
+	Arena arena;
+
 	//Valency of each voronoi point for collapsing
-	std::map<std::pair<float,float>,int> valency;
+	std::map<std::pair<float,float>,int,std::less<std::pair<float,float> >,
+		ArenaAllocator<std::pair<const std::pair<float,float>,int> > > valency;
+
+	//Caches centroids of all cells, subfunction of createDiagram
+	void computeCentroids();
 
 	//Function to check if the voronoi point is on the boundary of the image.
 	bool onBoundary(Point p);
 	public: 
 		//Parametric Constructor
-		Voronoi(Image& inputImage) { imageRef = &inputImage;}
+		Voronoi(Image& inputImage)
+			: imageRef(&inputImage), width(inputImage.getWidth()), height(inputImage.getHeight()) {}
+
+		//Default Constructor, reset binds an image
+		Voronoi() : imageRef(nullptr), width(0), height(0) {}
+
+		Voronoi(const Voronoi&) = delete;
+		Voronoi& operator=(const Voronoi&) = delete;
+
+		//Binds the diagram to image. The next createDiagram reuses the cell buffers of the previous one.
+		void reset(Image& inputImage)
+		{
+			imageRef = &inputImage;
+			width = inputImage.getWidth();
+			height = inputImage.getHeight();
+		}
 		
-		//Creates Voronoi Diagram
-		void createDiagram(Graph& graph);
+		//Creates Voronoi Diagram, lapping createRegions, collapseValence2 and centroids on times if given
+		void createDiagram(Graph& graph, StageTimes* times = nullptr);
 		
+		//Empties the cells of the previous diagram, keeping their buffers. createDiagram starts with it,
+		//the steps below expect it when called by themselves.
+		void clear();
+
 		//Create Regions, subfunction to above
 		void createRegions(Graph& graph);
 
-		//Debugging function
-		void printVoronoi(std::string json_path);
+		//Debugging function, dumps cells as JSON with coordinates rounded to precision decimals.
+		//Returns false if the file couldn't be written completely.
+		bool printVoronoi(std::string json_path, int precision = 4);
+
+		//Dumps cells in a compact little-endian binary layout meant to be memory-mapped:
+		//	char     magic[4]                "DPXV"
+		//	uint32   version, width, height  version is 1
+		//	uint32   cellCount, vertexCount  cells in the same x-major order as the JSON dump
+		//	uint32   offsets[cellCount + 1]  first vertex of every cell, last one is vertexCount
+		//	float32  vertices[vertexCount][2]
+		//	float32  centroids[cellCount][2]
+		//	uint8    colors[cellCount][4]    R, G, B, 0
+		//Returns false if the file couldn't be written completely.
+		bool printVoronoiBinary(std::string bin_path);
 
 		//Collapsing valence 2 nodes for smoother voronoi
 		void collapseValence2();
 
 		//Accessors
 		std::vector<Point> operator()(int i,int j);
-		std::vector<Point> getHull(int i,int j);
+		const std::vector<Point>& getHull(int i,int j) const {return voronoiPts[i][j];}
+		Point getCentroid(int i,int j) const {return centroids[i][j];}
 		Image* getImage() {return imageRef;};
 };
 
@@ -0,0 +1,130 @@
+#pragma once
+
+#ifndef _WRITER_H
+#define _WRITER_H
+
+#include "format.h"
+
+#include <cstdio>
+#include <cstdint>
+#include <cstring>
+#include <string>
+#include <vector>
+
+//Class BufferedWriter: Buffered file sink for large text and binary dumps
+//Everything goes through one big buffer which is handed to the file only when full,
+//so no per-line flushing or locale-aware stream formatting is involved.
+
+class BufferedWriter
+{
+	std::FILE* file;
+	std::vector<char> buffer;
+	size_t used;
+
+	//Set once a write to the file came up short, e.g. on a full disk
+	bool failed;
+
+	//Decimals of floating point values written through operator<<, SHORTEST_PRECISION for round-trip
+	int precision;
+
+	//Make sure at least n bytes are free in the buffer
+	void reserve(size_t n)
+	{
+		if(used + n > buffer.size()) flush();
+	}
+
+	public:
+		//Opens file at path for binary writing, buffering upto capacity bytes. The capacity is raised
+		//to what a single formatted number may take.
+		BufferedWriter(const std::string& path, size_t capacity = 1 << 20)
+			: buffer(capacity < FORMAT_BUFFER_SIZE ? FORMAT_BUFFER_SIZE : capacity), used(0), failed(false), precision(4)
+		{
+			file = std::fopen(path.c_str(), "wb");
+		}
+
+		~BufferedWriter() { close(); }
+
+		BufferedWriter(const BufferedWriter&) = delete;
+		BufferedWriter& operator=(const BufferedWriter&) = delete;
+
+		//False if the file couldn't be opened or a write to it failed
+		bool good() const { return file != nullptr && !failed; }
+
+		void setPrecision(int decimals) { precision = decimals; }
+		int getPrecision() const { return precision; }
+
+		void write(const char* data, size_t n)
+		{
+			if(n > buffer.size())
+			{
+				//Too big to be worth copying, hand it directly to the file
+				flush();
+				if(file && std::fwrite(data, 1, n, file) != n) failed = true;
+				return;
+			}
+			reserve(n);
+			std::memcpy(buffer.data() + used, data, n);
+			used += n;
+		}
+
+		void put(char c)
+		{
+			reserve(1);
+			buffer[used++] = c;
+		}
+
+		void writeInt(long long v)
+		{
+			reserve(FORMAT_BUFFER_SIZE);
+			used = formatInt(buffer.data() + used, v) - buffer.data();
+		}
+
+		//Number formatted as by formatNumber, e.g. 12.5 / 3 / 0.3333 with 4 decimals
+		void writeFloat(double v, int decimals)
+		{
+			reserve(FORMAT_BUFFER_SIZE);
+			used = formatNumber(buffer.data() + used, v, decimals) - buffer.data();
+		}
+
+		void writeFloat(double v) { writeFloat(v, precision); }
+
+		//Little endian binary values, independent of the host byte order
+		void writeU32(uint32_t v)
+		{
+			reserve(4);
+			for(int i = 0; i < 4; i++) buffer[used++] = char((v >> (8 * i)) & 0xff);
+		}
+
+		void writeF32(float v)
+		{
+			uint32_t bits;
+			std::memcpy(&bits, &v, sizeof(bits));
+			writeU32(bits);
+		}
+
+		BufferedWriter& operator<<(const char* s) { write(s, std::strlen(s)); return *this; }
+		BufferedWriter& operator<<(const std::string& s) { write(s.data(), s.size()); return *this; }
+		BufferedWriter& operator<<(char c) { put(c); return *this; }
+		BufferedWriter& operator<<(int v) { writeInt(v); return *this; }
+		BufferedWriter& operator<<(unsigned int v) { writeInt(v); return *this; }
+		BufferedWriter& operator<<(float v) { writeFloat(v); return *this; }
+		BufferedWriter& operator<<(double v) { writeFloat(v); return *this; }
+
+		void flush()
+		{
+			if(file && used && std::fwrite(buffer.data(), 1, used, file) != used) failed = true;
+			used = 0;
+		}
+
+		//Flushes and closes the file, returns false if anything written since opening was lost
+		bool close()
+		{
+			if(!file) return false;
+			flush();
+			if(std::fclose(file) != 0) failed = true;
+			file = nullptr;
+			return !failed;
+		}
+};
+
+#endif
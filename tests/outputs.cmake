@@ -0,0 +1,62 @@
+# Runs a front end on a copy of every .bmp of INPUTS and compares the SHA-256 of every file it writes
+# with a manifest of expected hashes, in the format of sha256sum.
+#
+#   cmake -DTOOL=<executable> "-DARGS=<arguments before the image>" -DINPUTS=<directory>
+#         -DWORK=<scratch directory> -DEXPECTED=<manifest> -P outputs.cmake
+#
+# The tools write their outputs next to their input, hence the copies. On a mismatch the hashes of this
+# run are left in WORK/actual.sha256; copy it over the manifest if the change is intended.
+
+foreach(var TOOL INPUTS WORK EXPECTED)
+    if(NOT DEFINED ${var})
+        message(FATAL_ERROR "${var} is not set")
+    endif()
+endforeach()
+separate_arguments(arguments UNIX_COMMAND "${ARGS}")
+
+file(REMOVE_RECURSE "${WORK}")
+file(MAKE_DIRECTORY "${WORK}")
+file(GLOB images RELATIVE "${INPUTS}" "${INPUTS}/*.bmp")
+list(SORT images)
+foreach(image ${images})
+    configure_file("${INPUTS}/${image}" "${WORK}/${image}" COPYONLY)
+endforeach()
+
+foreach(image ${images})
+    string(REGEX REPLACE "\\.bmp$" "" name "${image}")
+    execute_process(COMMAND "${TOOL}" ${arguments} "${WORK}/${name}"
+        RESULT_VARIABLE result OUTPUT_QUIET ERROR_VARIABLE errors)
+    if(NOT result EQUAL 0)
+        message(FATAL_ERROR "${TOOL} ${ARGS} ${name} failed (${result}): ${errors}")
+    endif()
+endforeach()
+
+# Everything in WORK but the copied inputs is an output
+file(GLOB outputs RELATIVE "${WORK}" "${WORK}/*")
+list(REMOVE_ITEM outputs ${images})
+list(SORT outputs)
+set(actual "")
+foreach(output ${outputs})
+    file(SHA256 "${WORK}/${output}" hash)
+    string(APPEND actual "${hash}  ${output}\n")
+endforeach()
+file(WRITE "${WORK}/actual.sha256" "${actual}")
+
+file(READ "${EXPECTED}" expected)
+if(NOT actual STREQUAL expected)
+    string(REPLACE "\n" ";" actualLines "${actual}")
+    string(REPLACE "\n" ";" expectedLines "${expected}")
+    foreach(line ${actualLines})
+        list(FIND expectedLines "${line}" found)
+        if(found EQUAL -1)
+            message("  changed or new: ${line}")
+        endif()
+    endforeach()
+    foreach(line ${expectedLines})
+        list(FIND actualLines "${line}" found)
+        if(found EQUAL -1)
+            message("  expected:       ${line}")
+        endif()
+    endforeach()
+    message(FATAL_ERROR "Outputs of ${TOOL} ${ARGS} differ from ${EXPECTED}, this run's hashes are in ${WORK}/actual.sha256")
+endif()
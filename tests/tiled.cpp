@@ -0,0 +1,42 @@
+#include "image.h"
+#include "graph.h"
+#include "voronoi.h"
+#include "tiled.h"
+
+#include <iostream>
+#include <cstdlib>
+
+using namespace std;
+
+//Reshapes <<bmp path>> tile by tile and as a whole and exits with 1 if any cell differs
+int main(int argc, char* argv[])
+{
+	if(argc < 3)
+	{
+		std::cout << "Usage: " << argv[0] << " <<bmp path>> <<tile size>>..." << endl;
+		return 1;
+	}
+	Image image(argv[1]);
+	Graph graph(image);
+	graph.planarize(false);
+	Voronoi diagram(image);
+	diagram.createDiagram(graph);
+
+	int failed = 0;
+	for(int i = 2; i < argc; i++)
+	{
+		int tileSize = atoi(argv[i]);
+		TiledVoronoi tiled(image, tileSize);
+		tiled.requestViewport(0, 0, image.getWidth(), image.getHeight());
+		int differing = 0;
+		for(int x = 0; x < image.getWidth(); x++)
+			for(int y = 0; y < image.getHeight(); y++)
+				differing += tiled.getHull(x, y) != diagram.getHull(x, y);
+		if(differing)
+		{
+			std::cout << argv[1] << ": " << differing << " cells differ with tiles of " << tileSize << endl;
+			failed = 1;
+		}
+	}
+	return failed;
+}